@@ -0,0 +1,253 @@
+#ifndef BLOOM_HPP
+#define BLOOM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "type_helper.hpp"
+
+namespace sjtu {
+
+// Keys the filter can hash consistently with equality: byte-view keys, integers, and types
+// whose object bytes are their value (no padding).
+template<typename T>
+inline constexpr bool bloom_hashable_v = has_key_bytes_v<T> || is_search_integral_v<T> || std::has_unique_object_representations_v<T>;
+
+inline uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Eight bytes per step, then the tail; finished with the murmur3 mixer.
+inline uint64_t hash_bytes(const void* data, size_t n) {
+    const char* p = static_cast<const char *>(data);
+    uint64_t h = n * 0x9e3779b97f4a7c15ull;
+    for (; n >= sizeof(uint64_t); p += sizeof(uint64_t), n -= sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    std::memcpy(&w, p, n);
+    return hash_mix(h ^ w);
+}
+
+template<typename KeyType>
+uint64_t key_hash(const KeyType& key) {
+    if constexpr (has_key_bytes_v<KeyType>) {
+        return hash_bytes(key.key_data(), key.key_size());
+    }
+    else if constexpr (is_search_integral_v<KeyType>) {
+        return hash_mix(static_cast<uint64_t>(key));
+    }
+    else {
+        return hash_bytes(&key, sizeof(KeyType));
+    }
+}
+
+struct BloomHeader {
+    uint64_t magic_;
+    uint64_t blocks_;
+    uint64_t capacity_;
+    uint64_t added_;
+};
+
+// Split-block Bloom filter: a key sets one bit in each of the eight words of a single
+// 32-byte block, so a probe touches one cache line. Bits are only ever set, with atomic
+// ors, so concurrent inserts and probes need no lock; erased keys stay in the filter.
+class BloomFilter {
+private:
+    static constexpr size_t BLOCK_WORDS = 8;
+
+    static constexpr uint64_t MAGIC = 0x314d4f4f4c42ull;
+
+    std::unique_ptr<std::atomic<uint32_t>[]> words_;
+    size_t blocks_ = 0;
+    size_t capacity_ = 0;
+    std::atomic<size_t> added_{0};
+
+    static uint32_t mask(uint64_t h, size_t i);
+
+    size_t block(uint64_t h) const;
+
+public:
+    BloomFilter() = default;
+
+    BloomFilter(const BloomFilter& oth) = delete;
+
+    BloomFilter& operator=(const BloomFilter& oth) = delete;
+
+    // Empties the filter and sizes it for capacity keys.
+    void reset(size_t capacity, size_t bits_per_key);
+
+    bool enabled() const;
+
+    // True when the key set at least one new bit.
+    bool add(uint64_t h);
+
+    bool may_contain(uint64_t h) const;
+
+    // More keys were added than the filter was sized for; its false-positive rate is rising.
+    bool overloaded() const;
+
+    size_t bytes() const;
+
+    bool load(const std::string& file_name);
+
+    // Writes a temporary file and renames it over file_name, so a torn write is never loaded.
+    void save(const std::string& file_name) const;
+};
+
+inline uint32_t BloomFilter::mask(uint64_t h, size_t i) {
+    static constexpr uint32_t SALT[BLOCK_WORDS] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                                                   0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+    return uint32_t(1) << ((static_cast<uint32_t>(h) * SALT[i]) >> 27);
+}
+
+inline size_t BloomFilter::block(uint64_t h) const {
+    return static_cast<size_t>(((h >> 32) * blocks_) >> 32);
+}
+
+inline void BloomFilter::reset(size_t capacity, size_t bits_per_key) {
+    blocks_ = std::max<size_t>(1, (capacity * bits_per_key + BLOCK_WORDS * 32 - 1) / (BLOCK_WORDS * 32));
+    capacity_ = capacity;
+    added_ = 0;
+    words_.reset(new std::atomic<uint32_t>[blocks_ * BLOCK_WORDS]);
+    for (size_t i = 0; i < blocks_ * BLOCK_WORDS; i++) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline bool BloomFilter::enabled() const {
+    return blocks_ != 0;
+}
+
+inline bool BloomFilter::add(uint64_t h) {
+    std::atomic<uint32_t>* w = words_.get() + block(h) * BLOCK_WORDS;
+    bool fresh = false;
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        uint32_t m = mask(h, i);
+        if ((w[i].load(std::memory_order_relaxed) & m) == 0) {
+            w[i].fetch_or(m, std::memory_order_relaxed);
+            fresh = true;
+        }
+    }
+    if (fresh) {
+        added_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return fresh;
+}
+
+inline bool BloomFilter::may_contain(uint64_t h) const {
+    const std::atomic<uint32_t>* w = words_.get() + block(h) * BLOCK_WORDS;
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        uint32_t m = mask(h, i);
+        if ((w[i].load(std::memory_order_relaxed) & m) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool BloomFilter::overloaded() const {
+    return added_.load(std::memory_order_relaxed) > capacity_;
+}
+
+inline size_t BloomFilter::bytes() const {
+    return blocks_ * BLOCK_WORDS * sizeof(uint32_t);
+}
+
+inline bool BloomFilter::load(const std::string& file_name) {
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    BloomHeader header;
+    bool ok = ::pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))
+              && header.magic_ == MAGIC && header.blocks_ > 0 && header.blocks_ < (uint64_t(1) << 32);
+    std::unique_ptr<uint32_t[]> raw;
+    size_t len = 0;
+    if (ok) {
+        len = header.blocks_ * BLOCK_WORDS * sizeof(uint32_t);
+        raw.reset(new uint32_t[header.blocks_ * BLOCK_WORDS]);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t r = ::pread(fd, reinterpret_cast<char *>(raw.get()) + done, len - done, sizeof(header) + done);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                break;
+            }
+            done += r;
+        }
+        ok = (done == len);
+    }
+    ::close(fd);
+    if (!ok) {
+        return false;
+    }
+    blocks_ = header.blocks_;
+    capacity_ = header.capacity_;
+    added_ = header.added_;
+    words_.reset(new std::atomic<uint32_t>[blocks_ * BLOCK_WORDS]);
+    for (size_t i = 0; i < blocks_ * BLOCK_WORDS; i++) {
+        words_[i].store(raw[i], std::memory_order_relaxed);
+    }
+    return true;
+}
+
+inline void BloomFilter::save(const std::string& file_name) const {
+    std::string tmp = file_name + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    std::unique_ptr<char[]> buf(new char[sizeof(BloomHeader) + bytes()]);
+    BloomHeader header{MAGIC, blocks_, capacity_, added_.load(std::memory_order_relaxed)};
+    std::memcpy(buf.get(), &header, sizeof(header));
+    for (size_t i = 0; i < blocks_ * BLOCK_WORDS; i++) {
+        uint32_t w = words_[i].load(std::memory_order_relaxed);
+        std::memcpy(buf.get() + sizeof(header) + i * sizeof(w), &w, sizeof(w));
+    }
+    size_t len = sizeof(header) + bytes();
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = ::write(fd, buf.get() + done, len - done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        done += r;
+    }
+    bool ok = (done == len) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    if (ok) {
+        std::rename(tmp.c_str(), file_name.c_str());
+    }
+    else {
+        std::remove(tmp.c_str());
+    }
+}
+
+} // namespace sjtu
+
+#endif // BLOOM_HPP
@@ -1,9 +1,20 @@
 #ifndef BPT_HPP
 #define BPT_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "bloom.hpp"
 #include "config.hpp"
 #include "page.hpp"
 #include "buffer.hpp"
@@ -15,23 +26,228 @@ namespace sjtu {
 BPT_TEMPLATE_ARGS
 class BPlusTree {
 private:
+    struct PathEntry {
+        diskpos_t pos_;
+        int slot_;
+    };
+
+    typedef typename BUFFER_MANAGER_TYPE::ConstHandle ConstHandle;
+
+    typedef std::pair<KEYPAIR_TYPE, MessageOp> Message;
+
+    // A page of the pinned top levels. Entry 0 is the root; the children of a page whose
+    // next level is pinned as well follow one another from first_, in slot order.
+    struct PinnedPage {
+        ConstHandle page_;
+        uint32_t first_;
+        uint32_t count_;
+    };
+
+    static constexpr uint32_t PINNED_NONE = UINT32_MAX;
+    static constexpr uint32_t PINNED_ROOT = UINT32_MAX - 1;
+
+    // Adds the lifetime of one public operation to its histogram when histograms are on.
+    class OpTimer {
+    private:
+        LatencyHistogram* histogram_ = nullptr;
+        std::chrono::steady_clock::time_point start_;
+
+    public:
+        OpTimer(BPlusTree* tree, OpKind kind);
+
+        ~OpTimer();
+    };
+
     BUFFER_MANAGER_TYPE buffer_;
-    std::shared_ptr<const PAGE_TYPE> cur_;
-    diskpos_t pos_;
     diskpos_t root_ = 0;
+    std::atomic<size_t> splits_{0};
+    std::atomic<size_t> merges_{0};
+    std::atomic<size_t> borrows_{0};
+    bool histograms_ = false;
+    std::array<LatencyHistogram, static_cast<size_t>(OpKind::Count)> latency_;
+    BloomFilter bloom_;
+    std::string bloom_file_;
+    size_t bloom_bits_per_key_ = BLOOM_BITS_PER_KEY;
+    std::atomic<size_t> bloom_negatives_{0};
+    bool buffered_ = false;
+    size_t fanout_ = INTERNAL_PAGE_TYPE::SLOT_COUNT;
+    size_t pending_ = 0;
+    size_t pinned_levels_ = 0;
+    size_t pinned_budget_ = 0;
+    std::vector<PinnedPage> pinned_;
+    diskpos_t pinned_root_ = 0;
+    bool pinned_stale_ = false;
+    size_t readahead_pages_ = 0;
+    Latch root_latch_;
+    Latch write_gate_;
+
+    bool descend(const KEYPAIR_TYPE& kp, std::vector<PathEntry>& path, KEYPAIR_TYPE* upper = nullptr);
+
+    // Holds the top pinned_levels_ internal levels, as far as they fit in pinned_budget_ pages.
+    void pin_levels();
+
+    // The page at pos, reached through slot of the previous page, read straight from the pinned
+    // levels; at tracks the walk and starts at PINNED_ROOT. Null once the walk leaves them, or
+    // when a split or merge moved the page, in which case they are rebuilt before the next walk.
+    const PAGE_TYPE* pinned_page(diskpos_t pos, int slot, uint32_t& at);
+
+    void insert_entry(const KEYPAIR_TYPE& kp);
+
+    void erase_entry(const KEYPAIR_TYPE& kp);
+
+    // True when the Bloom filter rules the key out; no page is read.
+    bool absent(const KeyType& key);
+
+    void note_key(const KeyType& key);
+
+    // Rebuilds the filter from the leaves once it holds more keys than it was sized for.
+    // Readers probe it without a lock, so a concurrent tree waits for the next open.
+    void grow_bloom();
+
+    void rebuild_bloom();
+
+    // Message-buffer mode: a write becomes a message in the root's buffer. A full buffer sends
+    // its largest batch, the messages bound for one child, a level down; a batch that reaches
+    // a leaf is merged into it at once. False when the root is a leaf.
+    bool push_message(const KEYPAIR_TYPE& kp, MessageOp op);
+
+    // Flushes until the root's buffer has a free slot. Between operations the moved pages
+    // may be committed; inside one, a commit would land between its log record and its effect.
+    void make_room(bool settle);
+
+    // Moves one batch out of the buffer at path.back(), first making room in the child when
+    // it is internal and too full; the path is stale afterwards.
+    void flush(std::vector<PathEntry>& path);
+
+    void apply_messages(std::vector<PathEntry>& path, const std::vector<Message>& batch);
+
+    // Applies every pending message, so that cursors can walk the leaves alone.
+    void apply_pending();
+
+    size_t internal_levels();
+
+    // Messages the node can still take. In buffered mode a buffer stops at the slots left
+    // beside a full set of children, so a split never has to divide it unevenly.
+    size_t room(const INTERNAL_PAGE_TYPE& node) const;
+
+    // Whether the internal page at pos has slots for that many more children and messages.
+    bool fits_messages(diskpos_t pos, size_t children, size_t messages);
+
+    bool find_messages(diskpos_t pos, int slot, size_t levels, std::vector<PathEntry>& path);
+
+    size_t count_messages(diskpos_t pos, size_t levels);
+
+    void shrink_root();
+
+    // Entries of key under pos, sorted, with the messages met on the way applied; a message
+    // is newer than anything below it.
+    void gather(diskpos_t pos, const KeyType& key, std::vector<KEYPAIR_TYPE>& out);
+
+    bool insert_leaf(std::vector<PathEntry>& path, const KEYPAIR_TYPE& kp);
+
+    bool erase_leaf(std::vector<PathEntry>& path, const KEYPAIR_TYPE& kp);
+
+    static bool safe(const PAGE_TYPE& page, bool erase, bool is_root);
 
-    void split();
+    int write_optimistic(const KEYPAIR_TYPE& kp, bool erase);
 
-    bool borrowl();
+    bool write_pessimistic(const KEYPAIR_TYPE& kp, bool erase);
 
-    bool borrowr();
+    bool write_latched(const KEYPAIR_TYPE& kp, bool erase);
+
+    void split(std::vector<PathEntry>& path, const std::vector<KEYPAIR_TYPE>& entries);
+
+    void overflow(std::vector<PathEntry>& path, const std::vector<KEYPAIR_TYPE>& entries);
+
+    std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> write_internal_chunks(const std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>>& entries, diskpos_t first_pos);
+
+    bool borrowl(INTERNAL_PAGE_TYPE& f, int k, diskpos_t cur_pos);
+
+    bool borrowr(INTERNAL_PAGE_TYPE& f, int k, diskpos_t cur_pos);
+
+    bool merge(INTERNAL_PAGE_TYPE& f, int k);
+
+    void balance(std::vector<PathEntry>& path);
+
+    static size_t fill_count(size_t capacity, double fill_factor);
+
+    static std::vector<size_t> chunk_sizes(size_t n, size_t fill, size_t capacity);
+
+    static std::vector<size_t> even_chunks(size_t n, size_t capacity, size_t at_least = 1);
+
+    void write_leaf(diskpos_t pos, const std::vector<KEYPAIR_TYPE>& entries, diskpos_t left, diskpos_t right);
+
+    diskpos_t build_internal_levels(std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>>& level, double fill_factor);
+
+public:
+    struct BatchStats {
+        size_t applied_ = 0;
+        size_t page_fetches_ = 0;
+        size_t splits_ = 0;
+        size_t merges_ = 0;
+    };
+
+    class Cursor {
+    private:
+        BPlusTree* tree_ = nullptr;
+        ConstHandle page_;
+        int idx_ = 0;
+        KEYPAIR_TYPE entry_;
+        size_t pages_read_ = 0;
+        // Readahead state: the leaf's parent and slot, valid while no page has been freed
+        // since they were found, the last slot read ahead and the current window.
+        diskpos_t parent_ = -1;
+        int slot_ = 0;
+        int fetched_ = 0;
+        size_t freed_ = 0;
+        size_t run_ = 0;
+        size_t window_ = 0;
+
+        void load(diskpos_t pos);
+
+        void step_left();
+
+        void normalize();
+
+        friend class BPlusTree;
+
+    public:
+        Cursor() = default;
+
+        Cursor(const Cursor& oth) = delete;
+
+        Cursor(Cursor&& oth) = default;
+
+        Cursor& operator=(const Cursor& oth) = delete;
+
+        Cursor& operator=(Cursor&& oth) = default;
+
+        bool valid() const;
+
+        const KeyType& key() const;
+
+        const ValueType& value() const;
+
+        void next();
+
+        void prev();
+
+        size_t pages_read() const;
+    };
+
+private:
+    template<typename Choose>
+    void seek(Cursor& cursor, Choose choose);
 
-    void merge();
+    void seek_below(Cursor& cursor, const KEYPAIR_TYPE& bound);
 
-    void balance();
+    // Called when a cursor has stepped right into a new leaf. After READAHEAD_TRIGGER such steps
+    // in a row, the leaf's following siblings under its parent are read in one batch; the next
+    // batch goes out when the cursor is half a window from the end of the last, twice as large.
+    void read_ahead(Cursor& cursor);
 
 public:
-    BPlusTree(const std::string file_name = "bpt.dat");
+    BPlusTree(const std::string file_name = "bpt.dat", const BufferOptions& options = BufferOptions());
 
     ~BPlusTree();
 
@@ -43,505 +259,1933 @@ public:
 
     void erase(const KeyType& key, const ValueType& val);
 
+    BatchStats insert_batch(std::vector<KEYPAIR_TYPE>& batch);
+
+    BatchStats erase_batch(std::vector<KEYPAIR_TYPE>& batch);
+
+    template<typename Source>
+    size_t bulk_load(Source source, double fill_factor = BULK_LOAD_FILL_FACTOR);
+
+    Cursor begin();
+
+    Cursor last();
+
+    Cursor lower_bound(const KeyType& key);
+
+    Cursor upper_bound(const KeyType& key);
+
+    template<typename Callback>
+    size_t scan(const KeyType& lo, const KeyType& hi, Callback callback);
+
+    template<typename Callback>
+    size_t rscan(const KeyType& lo, const KeyType& hi, Callback callback);
+
+    void sync();
+
+    IoBackend io_backend() const;
+
+    size_t reused_pages() const;
+
+    size_t appended_pages() const;
+
+    size_t foreground_writes() const;
+
+    size_t background_writes() const;
+
+    size_t cache_hits() const;
+
+    size_t cache_misses() const;
+
+    TreeStats stats();
+
 };
 
 BPT_TEMPLATE_ARGS
-BPT_TYPE::BPlusTree(const std::string file_name) : buffer_(CACHE_CAPACITY, file_name) {
+BPT_TYPE::BPlusTree(const std::string file_name, const BufferOptions& options) : buffer_(file_name, options), histograms_(options.latency_histograms_) {
     root_ = buffer_.get_root_pos();
+    buffered_ = options.message_buffers_ && !buffer_.concurrent();
+    if (!buffer_.concurrent()) {
+        pinned_levels_ = options.pinned_levels_;
+        pinned_budget_ = options.pinned_pages_;
+        if (options.readahead_) {
+            readahead_pages_ = std::min(options.readahead_pages_, options.cache_capacity_ / 4);
+        }
+    }
+    if (buffered_) {
+        fanout_ = std::min(std::max<size_t>(options.message_fanout_, 4), INTERNAL_PAGE_TYPE::SLOT_COUNT / 2);
+    }
+    // Messages left by a buffered run take the logged writes through the buffers too, so
+    // they land in order; afterwards they are applied unless this run buffers as well.
+    pending_ = count_messages(root_, internal_levels());
+    if (buffer_.logging()) {
+        for (const auto& op : buffer_.take_redo()) {
+            if (op.first == LogType::Insert) {
+                insert_entry(op.second);
+            }
+            else {
+                erase_entry(op.second);
+            }
+        }
+        buffer_.checkpoint(root_);
+    }
+    if (!buffered_) {
+        apply_pending();
+    }
+    // The filter file is only valid for the data file as it was closed, so it is removed once
+    // read and written again by the destructor; after a crash the filter is rebuilt from the
+    // leaves, replayed writes included. A clean close leaves nothing to replay.
+    bloom_file_ = file_name + ".bloom";
+    if constexpr (bloom_hashable_v<KeyType>) {
+        if (options.bloom_filter_) {
+            bloom_bits_per_key_ = options.bloom_bits_per_key_;
+            if (!bloom_.load(bloom_file_) || bloom_.overloaded()) {
+                rebuild_bloom();
+            }
+        }
+    }
+    std::remove(bloom_file_.c_str());
 }
 
 BPT_TEMPLATE_ARGS
 BPT_TYPE::~BPlusTree() {
     buffer_.set_root_pos(root_);
+    if (bloom_.enabled()) {
+        bloom_.save(bloom_file_);
+    }
 }
 
 BPT_TEMPLATE_ARGS
-std::optional<ValueType> BPT_TYPE::find(const KeyType& key) {
-    if (root_ == 0) {
-        return std::nullopt;
+void BPT_TYPE::Cursor::load(diskpos_t pos) {
+    ConstHandle page = tree_->buffer_.get_page(pos);
+    page.latch(false);
+    page_ = std::move(page);
+    pages_read_++;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::Cursor::step_left() {
+    run_ = 0;
+    while (page_ && idx_ < 0 && page_->as_leaf().left_ != -1) {
+        const LEAF_PAGE_TYPE& leaf = page_->as_leaf();
+        ConstHandle page = tree_->buffer_.get_page(leaf.left_);
+        if (page.try_latch(false)) {
+            page_ = std::move(page);
+            pages_read_++;
+            idx_ = static_cast<int>(page_->as_leaf().size_) - 1;
+            return;
+        }
+        KEYPAIR_TYPE bound = leaf.front();
+        page.reset();
+        page_.reset();
+        tree_->seek_below(*this, bound);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::Cursor::normalize() {
+    // Message-buffer mode can leave a leaf empty when no sibling under its parent takes it in.
+    if (idx_ >= static_cast<int>(page_->as_leaf().size_)) {
+        while (idx_ >= static_cast<int>(page_->as_leaf().size_) && page_->as_leaf().right_ != -1) {
+            load(page_->as_leaf().right_);
+            idx_ = 0;
+            tree_->read_ahead(*this);
+        }
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(key);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
+    else if (idx_ < 0 && page_->as_leaf().left_ != -1) {
+        step_left();
     }
-    int k = cur_->lower_bound(key);
-    if (cur_->data_[k].key_ != key) {
-        return std::nullopt;
+    if (valid()) {
+        entry_ = page_->as_leaf().at(idx_);
     }
-    return cur_->data_[k].val_;
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::find_all(const KeyType& key, std::vector<ValueType>& vec) {
-    vec.clear();
+bool BPT_TYPE::Cursor::valid() const {
+    return page_ && idx_ >= 0 && idx_ < static_cast<int>(page_->as_leaf().size_);
+}
+
+BPT_TEMPLATE_ARGS
+const KeyType& BPT_TYPE::Cursor::key() const {
+    return entry_.key_;
+}
+
+BPT_TEMPLATE_ARGS
+const ValueType& BPT_TYPE::Cursor::value() const {
+    return entry_.val_;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::Cursor::next() {
+    if (!page_ || idx_ >= static_cast<int>(page_->as_leaf().size_)) {
+        return;
+    }
+    idx_++;
+    const LEAF_PAGE_TYPE& leaf = page_->as_leaf();
+    if (idx_ < static_cast<int>(leaf.size_) && leaf.repeats_key(idx_)) {
+        entry_.val_ = leaf.value_at(idx_);
+        return;
+    }
+    normalize();
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::Cursor::prev() {
+    if (!page_ || idx_ < 0) {
+        return;
+    }
+    idx_--;
+    const LEAF_PAGE_TYPE& leaf = page_->as_leaf();
+    if (idx_ >= 0 && idx_ + 1 < static_cast<int>(leaf.size_) && leaf.repeats_key(idx_ + 1)) {
+        entry_.val_ = leaf.value_at(idx_);
+        return;
+    }
+    normalize();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::Cursor::pages_read() const {
+    return pages_read_;
+}
+
+BPT_TEMPLATE_ARGS
+template<typename Choose>
+void BPT_TYPE::seek(Cursor& cursor, Choose choose) {
+    cursor.tree_ = this;
+    std::shared_lock<Latch> root_lock(root_latch_, std::defer_lock);
+    if (buffer_.concurrent()) {
+        root_lock.lock();
+    }
     if (root_ == 0) {
         return;
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(key);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
+    diskpos_t pos = root_;
+    int slot = -1;
+    uint32_t at = PINNED_ROOT;
+    while (const PAGE_TYPE* page = pinned_page(pos, slot, at)) {
+        slot = choose(page->as_internal());
+        pos = page->as_internal().ch_[slot];
+        cursor.pages_read_++;
+    }
+    cursor.load(pos);
+    if (root_lock.owns_lock()) {
+        root_lock.unlock();
     }
-    int k = cur_->lower_bound(key);
-    if (cur_->data_[k].key_ != key) {
+    while (cursor.page_->type() != PageType::Leaf) {
+        const INTERNAL_PAGE_TYPE& node = cursor.page_->as_internal();
+        cursor.load(node.ch_[choose(node)]);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::seek_below(Cursor& cursor, const KEYPAIR_TYPE& bound) {
+    seek(cursor, [&bound](const INTERNAL_PAGE_TYPE& node) {
+        return node.lower_bound(bound);
+    });
+    if (!cursor.page_) {
         return;
     }
-    int curk = k;
-    while (cur_->data_[curk].key_ == key) {
-        vec.push_back(cur_->data_[curk].val_);
-        if (curk < cur_->size_ - 1) {
-            curk++;
-        }
-        else {
-            if (cur_->right_ == -1) {
-                break;
-            }
-            else {
-                pos_ = cur_->right_;
-                cur_ = buffer_.get_page(pos_);
-                curk = 0;
-            }
-        }
+    const LEAF_PAGE_TYPE& leaf = cursor.page_->as_leaf();
+    int k = leaf.lower_bound(bound);
+    if (leaf.size_ > 0 && leaf.at(k) < bound) {
+        k++;
     }
+    cursor.idx_ = k - 1;
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::split() {
-    PAGE_TYPE newp;
-    newp.size_ = PAGE_SLOT_COUNT / 2;
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    diskpos_t parent_pos = cur_mut->fa_;
-    cur_mut->size_ = PAGE_SLOT_COUNT / 2;
-    if (cur_mut->type_ == PageType::Leaf) {
-        newp.type_ = PageType::Leaf;
+void BPT_TYPE::read_ahead(Cursor& cursor) {
+    if (readahead_pages_ == 0 || ++cursor.run_ < READAHEAD_TRIGGER) {
+        return;
+    }
+    diskpos_t pos = cursor.page_.pos();
+    // A remembered parent is read again only while no page has been freed, so it is still
+    // an internal page; if it no longer lists the leaf next, the leaf is looked up again.
+    bool tracked = cursor.parent_ != -1 && cursor.freed_ == buffer_.freed_pages();
+    if (tracked) {
+        auto parent = buffer_.get_page(cursor.parent_);
+        const INTERNAL_PAGE_TYPE& node = parent->as_internal();
+        tracked = cursor.slot_ + 1 < static_cast<int>(node.size_) && node.ch_[cursor.slot_ + 1] == pos;
+    }
+    if (tracked) {
+        cursor.slot_++;
     }
     else {
-        newp.type_ = PageType::Internal;
-    }
-    newp.fa_ = parent_pos;
-    newp.left_ = cur_pos;
-    newp.right_ = cur_mut->right_;
-    if (cur_mut->type_ == PageType::Leaf) {
-        for (int i = 0; i < newp.size_; i++) {
-            newp.data_[i] = cur_mut->data_[i + newp.size_];
-        }
-        KEYPAIR_TYPE split_at = cur_mut->back();
-        KEYPAIR_TYPE max_pair = newp.back();
-        if (parent_pos != -1) {
-            auto f = buffer_.get_page_mutable(parent_pos);
-            diskpos_t fa_pos = f->lower_bound(max_pair);
-            for (int i = f->size_ - 1; i >= fa_pos; i--) {
-                f->data_[i + 1] = f->data_[i];
-                f->ch_[i + 1] = f->ch_[i];
-            }
-            diskpos_t newp_pos = buffer_.insert_page(newp);
-            f->data_[fa_pos] = split_at;
-            f->data_[fa_pos + 1] = max_pair;
-            f->ch_[fa_pos] = cur_pos;
-            f->ch_[fa_pos + 1] = newp_pos;
-            f->size_++;
-            if (cur_mut->right_ != -1) {
-                auto rp = buffer_.get_page_mutable(cur_mut->right_);
-                rp->left_ = newp_pos;
-                buffer_.finish_use(cur_mut->right_);
-            }
-            cur_mut->right_ = newp_pos;
-            bool need_split_parent = (f->size_ == PAGE_SLOT_COUNT);
-            buffer_.finish_use(parent_pos);
-            buffer_.finish_use(cur_pos);
-            if (need_split_parent) {
-                pos_ = parent_pos;
-                split();
-            }
+        cursor.parent_ = -1;
+        if (cursor.page_->as_leaf().size_ == 0) {
+            return;
         }
-        else {
-            PAGE_TYPE newr;
-            newr.type_ = PageType::Internal;
-            newr.size_ = 2;
-            newr.data_[0] = split_at;
-            newr.data_[1] = max_pair;
-            newr.ch_[0] = cur_pos;
-            diskpos_t newp_pos = buffer_.insert_page(newp);
-            newr.ch_[1] = newp_pos;
-            cur_mut->right_ = newp_pos;
-            root_ = buffer_.insert_page(newr);
-            cur_mut->fa_ = root_;
-            auto newp_mut = buffer_.get_page_mutable(newp_pos);
-            newp_mut->fa_ = root_;
-            buffer_.finish_use(newp_pos);
-            buffer_.finish_use(cur_pos);
+        std::vector<PathEntry> path;
+        descend(cursor.page_->as_leaf().front(), path);
+        if (path.size() < 2 || path.back().pos_ != pos) {
+            return;
         }
+        cursor.parent_ = path[path.size() - 2].pos_;
+        cursor.slot_ = path.back().slot_;
+        cursor.fetched_ = cursor.slot_;
+        cursor.freed_ = buffer_.freed_pages();
+    }
+    if (cursor.fetched_ - cursor.slot_ > static_cast<int>(cursor.window_ / 2)) {
+        return;
+    }
+    cursor.window_ = (cursor.window_ == 0) ? std::min(READAHEAD_MIN, readahead_pages_) : std::min(cursor.window_ * 2, readahead_pages_);
+    auto parent = buffer_.get_page(cursor.parent_);
+    const INTERNAL_PAGE_TYPE& node = parent->as_internal();
+    int from = std::max(cursor.fetched_, cursor.slot_) + 1;
+    int to = std::min(cursor.slot_ + static_cast<int>(cursor.window_), static_cast<int>(node.size_) - 1);
+    if (from > to) {
         return;
     }
+    buffer_.prefetch(std::vector<diskpos_t>(node.ch_ + from, node.ch_ + to + 1));
+    cursor.fetched_ = to;
+}
 
-    diskpos_t newp_pos = buffer_.insert_page(newp);
-    auto newp_mut = buffer_.get_page_mutable(newp_pos);
-    for (int i = 0; i < newp_mut->size_; i++) {
-        newp_mut->data_[i] = cur_mut->data_[i + newp_mut->size_];
-        newp_mut->ch_[i] = cur_mut->ch_[i + newp_mut->size_];
-    }
-    for (int i = 0; i < newp_mut->size_; i++) {
-        auto ch = buffer_.get_page_mutable(newp_mut->ch_[i]);
-        ch->fa_ = newp_pos;
-        buffer_.finish_use(newp_mut->ch_[i]);
-    }
-    KEYPAIR_TYPE split_at = cur_mut->back();
-    KEYPAIR_TYPE max_pair = newp_mut->back();
-    if (parent_pos != -1) {
-        auto f = buffer_.get_page_mutable(parent_pos);
-        diskpos_t fa_pos = f->lower_bound(max_pair);
-        for (int i = f->size_ - 1; i >= fa_pos; i--) {
-            f->data_[i + 1] = f->data_[i];
-            f->ch_[i + 1] = f->ch_[i];
-        }
-        f->data_[fa_pos] = split_at;
-        f->data_[fa_pos + 1] = max_pair;
-        f->ch_[fa_pos] = cur_pos;
-        f->ch_[fa_pos + 1] = newp_pos;
-        f->size_++;
-        if (cur_mut->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(cur_mut->right_);
-            rp->left_ = newp_pos;
-            buffer_.finish_use(cur_mut->right_);
-        }
-        cur_mut->right_ = newp_pos;
-        bool need_split_parent = (f->size_ == PAGE_SLOT_COUNT);
-        buffer_.finish_use(parent_pos);
-        buffer_.finish_use(cur_pos);
-        buffer_.finish_use(newp_pos);
-        if (need_split_parent) {
-            pos_ = parent_pos;
-            split();
-        }
+BPT_TEMPLATE_ARGS
+typename BPT_TYPE::Cursor BPT_TYPE::begin() {
+    if (pending_ > 0) {
+        apply_pending();
     }
-    else {
-        PAGE_TYPE newr;
-        newr.type_ = PageType::Internal;
-        newr.size_ = 2;
-        newr.data_[0] = split_at;
-        newr.data_[1] = max_pair;
-        newr.ch_[0] = cur_pos;
-        newr.ch_[1] = newp_pos;
-        root_ = buffer_.insert_page(newr);
-        cur_mut->fa_ = root_;
-        newp_mut->fa_ = root_;
-        buffer_.finish_use(cur_pos);
-        buffer_.finish_use(newp_pos);
+    Cursor cursor;
+    seek(cursor, [](const INTERNAL_PAGE_TYPE&) {
+        return 0;
+    });
+    cursor.idx_ = 0;
+    if (cursor.page_) {
+        cursor.normalize();
     }
+    return cursor;
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::insert(const KeyType& key, const ValueType& val) {
-    KEYPAIR_TYPE kp(key, val);
-    if (root_ == 0) {
-        PAGE_TYPE newr;
-        newr.size_ = 1;
-        newr.type_ = PageType::Leaf;
-        newr.data_[0] = kp;
-        root_ = buffer_.insert_page(newr);
-        return;
+typename BPT_TYPE::Cursor BPT_TYPE::last() {
+    if (pending_ > 0) {
+        apply_pending();
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        auto cur_mut = buffer_.get_page_mutable(pos_);
-        int k = cur_mut->lower_bound(kp);
-        if (cur_mut->data_[k] < kp) {
-            cur_mut->data_[k] = kp;
-        }
-        diskpos_t child = cur_mut->ch_[k];
-        buffer_.finish_use(pos_);
-        pos_ = child;
-        cur_ = buffer_.get_page(pos_);
-    }
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    int k = cur_mut->lower_bound(kp);
-    if (cur_mut->data_[k] == kp) {
-        buffer_.finish_use(pos_);
-        return;
+    Cursor cursor;
+    seek(cursor, [](const INTERNAL_PAGE_TYPE& node) {
+        return static_cast<int>(node.size_) - 1;
+    });
+    if (cursor.page_) {
+        cursor.idx_ = static_cast<int>(cursor.page_->as_leaf().size_) - 1;
+        cursor.normalize();
     }
-    if (cur_mut->data_[k] < kp) {
-        cur_mut->data_[k + 1] = kp;
-        cur_mut->size_++;
+    return cursor;
+}
+
+BPT_TEMPLATE_ARGS
+typename BPT_TYPE::Cursor BPT_TYPE::lower_bound(const KeyType& key) {
+    if (pending_ > 0) {
+        apply_pending();
     }
-    else {
-        for (int i = static_cast<int>(cur_mut->size_) - 1; i >= k; i--) {
-            cur_mut->data_[i + 1] = cur_mut->data_[i];
-        }
-        cur_mut->data_[k] = kp;
-        cur_mut->size_++;
+    Cursor cursor;
+    seek(cursor, [&key](const INTERNAL_PAGE_TYPE& node) {
+        return node.lower_bound(key);
+    });
+    if (!cursor.page_) {
+        return cursor;
     }
-    bool need_split = (cur_mut->size_ == PAGE_SLOT_COUNT);
-    buffer_.finish_use(pos_);
-    if (need_split) {
-        split();
+    const LEAF_PAGE_TYPE& leaf = cursor.page_->as_leaf();
+    int k = leaf.lower_bound(key);
+    if (leaf.size_ > 0 && ordered_less(leaf.at(k).key_, key)) {
+        k++;
     }
+    cursor.idx_ = std::max(k, 0);
+    cursor.normalize();
+    return cursor;
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::erase(const KeyType& key, const ValueType& val) {
-    if (root_ == 0) {
-        return;
+typename BPT_TYPE::Cursor BPT_TYPE::upper_bound(const KeyType& key) {
+    if (pending_ > 0) {
+        apply_pending();
     }
-    KEYPAIR_TYPE kp(key, val);
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(kp);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
-    }
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    int k = cur_mut->lower_bound(kp);
-    if (cur_mut->data_[k] != kp) {
-        buffer_.finish_use(pos_);
-        return;
+    Cursor cursor;
+    seek(cursor, [&key](const INTERNAL_PAGE_TYPE& node) {
+        return node.upper_bound(key);
+    });
+    if (!cursor.page_) {
+        return cursor;
+    }
+    const LEAF_PAGE_TYPE& leaf = cursor.page_->as_leaf();
+    int k = leaf.upper_bound(key);
+    if (leaf.size_ > 0 && !ordered_less(key, leaf.at(k).key_)) {
+        k++;
     }
-    for (int i = k; i < static_cast<int>(cur_mut->size_) - 1; i++) {
-        cur_mut->data_[i] = cur_mut->data_[i + 1];
-    }
-    cur_mut->size_--;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    diskpos_t cur_pos = pos_;
-    diskpos_t fpos = cur_mut->fa_;
-    buffer_.finish_use(cur_pos);
-    while (fpos != -1) {
-        auto f = buffer_.get_page_mutable(fpos);
-        int p = f->lower_bound(kp);
-        diskpos_t next_parent = f->fa_;
-        if (f->data_[p] == kp) {
-            f->data_[p] = max_pair;
-            buffer_.finish_use(fpos);
-            fpos = next_parent;
+    cursor.idx_ = std::max(k, 0);
+    cursor.normalize();
+    return cursor;
+}
+
+BPT_TEMPLATE_ARGS
+template<typename Callback>
+size_t BPT_TYPE::scan(const KeyType& lo, const KeyType& hi, Callback callback) {
+    Cursor cursor = lower_bound(lo);
+    while (cursor.valid() && !ordered_less(hi, cursor.key())) {
+        if constexpr (std::is_same_v<std::invoke_result_t<Callback, const KeyType&, const ValueType&>, bool>) {
+            if (!callback(cursor.key(), cursor.value())) {
+                break;
+            }
         }
         else {
-            buffer_.finish_use(fpos);
-            break;
+            callback(cursor.key(), cursor.value());
         }
+        cursor.next();
     }
-    auto check_cur = buffer_.get_page(pos_);
-    bool need_balance = (check_cur->size_ < PAGE_SLOT_COUNT / 2);
-    if (need_balance) {
-        balance();
-    }
+    return cursor.pages_read();
 }
 
 BPT_TEMPLATE_ARGS
-bool BPT_TYPE::borrowl() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1 || cur_mut->size_ == 0) {
-        buffer_.finish_use(cur_pos);
-        return false;
+template<typename Callback>
+size_t BPT_TYPE::rscan(const KeyType& lo, const KeyType& hi, Callback callback) {
+    Cursor cursor = upper_bound(hi);
+    cursor.prev();
+    while (cursor.valid() && !ordered_less(cursor.key(), lo)) {
+        if constexpr (std::is_same_v<std::invoke_result_t<Callback, const KeyType&, const ValueType&>, bool>) {
+            if (!callback(cursor.key(), cursor.value())) {
+                break;
+            }
+        }
+        else {
+            callback(cursor.key(), cursor.value());
+        }
+        cursor.prev();
     }
-    diskpos_t fpos = cur_mut->fa_;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
-    if (k == 0) {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+    return cursor.pages_read();
+}
+
+BPT_TEMPLATE_ARGS
+BPT_TYPE::OpTimer::OpTimer(BPlusTree* tree, OpKind kind) {
+    if (tree->histograms_) {
+        histogram_ = &tree->latency_[static_cast<size_t>(kind)];
+        start_ = std::chrono::steady_clock::now();
     }
-    diskpos_t bpos = f->ch_[k - 1];
-    auto bro = buffer_.get_page_mutable(bpos);
-    if (bro->size_ <= PAGE_SLOT_COUNT / 2) {
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+}
+
+BPT_TEMPLATE_ARGS
+BPT_TYPE::OpTimer::~OpTimer() {
+    if (histogram_ != nullptr) {
+        histogram_->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
     }
-    for (int i = static_cast<int>(cur_mut->size_) - 1; i >= 0; i--) {
-        cur_mut->data_[i + 1] = cur_mut->data_[i];
-        cur_mut->ch_[i + 1] = cur_mut->ch_[i];
-    }
-    cur_mut->data_[0] = bro->back();
-    cur_mut->ch_[0] = bro->ch_[bro->size_ - 1];
-    cur_mut->size_++;
-    bro->size_--;
-    if (cur_mut->type_ == PageType::Internal) {
-        auto son = buffer_.get_page_mutable(cur_mut->ch_[0]);
-        son->fa_ = cur_pos;
-        buffer_.finish_use(cur_mut->ch_[0]);
-    }
-    f->data_[k - 1] = bro->back();
-    buffer_.finish_use(bpos);
-    buffer_.finish_use(fpos);
-    buffer_.finish_use(cur_pos);
-    return true;
 }
 
 BPT_TEMPLATE_ARGS
-bool BPT_TYPE::borrowr() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1 || cur_mut->size_ == 0) {
-        buffer_.finish_use(cur_pos);
-        return false;
+std::optional<ValueType> BPT_TYPE::find(const KeyType& key) {
+    OpTimer timer(this, OpKind::Find);
+    if (absent(key)) {
+        return std::nullopt;
     }
-    diskpos_t fpos = cur_mut->fa_;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
-    if (k == static_cast<int>(f->size_) - 1) {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+    if (pending_ > 0) {
+        std::vector<KEYPAIR_TYPE> found;
+        gather(root_, key, found);
+        if (found.empty()) {
+            return std::nullopt;
+        }
+        return found[0].val_;
     }
-    diskpos_t bpos = f->ch_[k + 1];
-    auto bro = buffer_.get_page_mutable(bpos);
-    if (bro->size_ <= PAGE_SLOT_COUNT / 2) {
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+    Cursor cursor = lower_bound(key);
+    if (!cursor.valid() || ordered_less(key, cursor.key())) {
+        return std::nullopt;
     }
-    cur_mut->data_[cur_mut->size_] = bro->data_[0];
-    cur_mut->ch_[cur_mut->size_] = bro->ch_[0];
-    cur_mut->size_++;
-    for (int i = 0; i < static_cast<int>(bro->size_) - 1; i++) {
-        bro->data_[i] = bro->data_[i + 1];
-        bro->ch_[i] = bro->ch_[i + 1];
-    }
-    bro->size_--;
-    if (cur_mut->type_ == PageType::Internal) {
-        auto son = buffer_.get_page_mutable(cur_mut->ch_[cur_mut->size_ - 1]);
-        son->fa_ = cur_pos;
-        buffer_.finish_use(cur_mut->ch_[cur_mut->size_ - 1]);
-    }
-    f->data_[k] = cur_mut->back();
-    buffer_.finish_use(bpos);
-    buffer_.finish_use(fpos);
-    buffer_.finish_use(cur_pos);
-    return true;
+    return cursor.value();
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::merge() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1) {
-        buffer_.finish_use(cur_pos);
+void BPT_TYPE::find_all(const KeyType& key, std::vector<ValueType>& vec) {
+    OpTimer timer(this, OpKind::FindAll);
+    vec.clear();
+    if (absent(key)) {
         return;
     }
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    diskpos_t fpos = cur_mut->fa_;
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
-    if (k) {
-        diskpos_t bpos = f->ch_[k - 1];
-        auto bro = buffer_.get_page_mutable(bpos);
-        if (cur_mut->type_ == PageType::Internal) {
-            for (int i = 0; i < static_cast<int>(cur_mut->size_); i++) {
-                auto son = buffer_.get_page_mutable(cur_mut->ch_[i]);
-                son->fa_ = bpos;
-                buffer_.finish_use(cur_mut->ch_[i]);
-            }
-        }
-        for (int i = 0; i < static_cast<int>(cur_mut->size_); i++) {
-            bro->data_[bro->size_ + i] = cur_mut->data_[i];
-            bro->ch_[bro->size_ + i] = cur_mut->ch_[i];
-        }
-        bro->size_ += cur_mut->size_;
-        cur_mut->size_ = 0;
-        bro->right_ = cur_mut->right_;
-        if (cur_mut->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(cur_mut->right_);
-            rp->left_ = bpos;
-            buffer_.finish_use(cur_mut->right_);
-        }
-        for (int i = k; i < static_cast<int>(f->size_) - 1; i++) {
-            f->data_[i] = f->data_[i + 1];
-            f->ch_[i] = f->ch_[i + 1];
-        }
-        f->size_--;
-        f->data_[k - 1] = bro->back();
-        bool need_balance = (f->size_ < PAGE_SLOT_COUNT / 2);
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        if (need_balance) {
-            pos_ = fpos;
-            balance();
-        }
-    }
-    else if (k != static_cast<int>(f->size_) - 1) {
-        diskpos_t bpos = f->ch_[k + 1];
-        auto bro = buffer_.get_page_mutable(bpos);
-        if (cur_mut->type_ == PageType::Internal) {
-            for (int i = 0; i < static_cast<int>(bro->size_); i++) {
-                auto son = buffer_.get_page_mutable(bro->ch_[i]);
-                son->fa_ = cur_pos;
-                buffer_.finish_use(bro->ch_[i]);
-            }
-        }
-        for (int i = 0; i < static_cast<int>(bro->size_); i++) {
-            cur_mut->data_[cur_mut->size_ + i] = bro->data_[i];
-            cur_mut->ch_[cur_mut->size_ + i] = bro->ch_[i];
-        }
-        cur_mut->size_ += bro->size_;
-        bro->size_ = 0;
-        cur_mut->right_ = bro->right_;
-        if (bro->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(bro->right_);
-            rp->left_ = cur_pos;
-            buffer_.finish_use(bro->right_);
-        }
-        for (int i = k + 1; i < static_cast<int>(f->size_) - 1; i++) {
-            f->data_[i] = f->data_[i + 1];
-            f->ch_[i] = f->ch_[i + 1];
-        }
-        f->size_--;
-        f->data_[k] = cur_mut->back();
-        bool need_balance = (f->size_ < PAGE_SLOT_COUNT / 2);
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        if (need_balance) {
-            pos_ = fpos;
-            balance();
+    if (pending_ > 0) {
+        std::vector<KEYPAIR_TYPE> found;
+        gather(root_, key, found);
+        for (const KEYPAIR_TYPE& kp : found) {
+            vec.push_back(kp.val_);
         }
+        return;
     }
-    else {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
+    // Copies each leaf's run of the key at once and compares a key only when entering a leaf.
+    Cursor cursor = lower_bound(key);
+    while (cursor.valid() && !ordered_less(key, cursor.key())) {
+        cursor.idx_ = cursor.page_->as_leaf().append_run(cursor.idx_, vec) - 1;
+        cursor.next();
     }
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::balance() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1) {
-        if (cur_mut->size_ == 0) {
-            root_ = 0;
+bool BPT_TYPE::absent(const KeyType& key) {
+    if constexpr (bloom_hashable_v<KeyType>) {
+        if (bloom_.enabled() && !bloom_.may_contain(key_hash(key))) {
+            bloom_negatives_.fetch_add(1, std::memory_order_relaxed);
+            return true;
         }
-        if (cur_mut->type_ == PageType::Internal && cur_mut->size_ == 1) {
-            diskpos_t child = cur_mut->ch_[0];
-            auto son = buffer_.get_page_mutable(child);
-            son->fa_ = -1;
-            buffer_.finish_use(child);
-            root_ = child;
+    }
+    return false;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::note_key(const KeyType& key) {
+    if constexpr (bloom_hashable_v<KeyType>) {
+        if (bloom_.enabled()) {
+            bloom_.add(key_hash(key));
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::grow_bloom() {
+    if (bloom_.enabled() && bloom_.overloaded() && !buffer_.concurrent()) {
+        rebuild_bloom();
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::rebuild_bloom() {
+    if constexpr (bloom_hashable_v<KeyType>) {
+        std::vector<uint64_t> hashes;
+        for (Cursor cursor = begin(); cursor.valid(); cursor.next()) {
+            // Equal keys are adjacent; the filter is sized by distinct keys.
+            uint64_t h = key_hash(cursor.key());
+            if (hashes.empty() || hashes.back() != h) {
+                hashes.push_back(h);
+            }
+        }
+        bloom_.reset(std::max(BLOOM_MIN_KEYS, hashes.size() * 2), bloom_bits_per_key_);
+        for (uint64_t h : hashes) {
+            bloom_.add(h);
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::descend(const KEYPAIR_TYPE& kp, std::vector<PathEntry>& path, KEYPAIR_TYPE* upper) {
+    path.clear();
+    bool bounded = false;
+    diskpos_t pos = root_;
+    int slot = -1;
+    uint32_t at = PINNED_ROOT;
+    while (true) {
+        path.push_back({pos, slot});
+        ConstHandle handle;
+        const PAGE_TYPE* page = pinned_page(pos, slot, at);
+        if (page == nullptr) {
+            handle = buffer_.get_page(pos);
+            page = handle.get();
+        }
+        if (page->type() == PageType::Leaf) {
+            return bounded;
+        }
+        const INTERNAL_PAGE_TYPE& node = page->as_internal();
+        slot = node.lower_bound(kp);
+        pos = node.ch_[slot];
+        if (upper != nullptr && slot < static_cast<int>(node.size_) - 1) {
+            *upper = node.data_[slot];
+            bounded = true;
         }
-        buffer_.finish_use(cur_pos);
-        return;
     }
-    buffer_.finish_use(cur_pos);
-    if (borrowl()) {
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::pin_levels() {
+    pinned_.clear();
+    buffer_.set_pinned(0);
+    pinned_root_ = root_;
+    pinned_stale_ = false;
+    if (root_ == 0 || pinned_budget_ == 0) {
         return;
     }
-    if (borrowr()) {
+    ConstHandle root = buffer_.get_page(root_);
+    if (root->type() != PageType::Internal) {
         return;
     }
-    merge();
+    pinned_.push_back({std::move(root), PINNED_NONE, 0});
+    // Level by level, while the next one is internal and fits whole.
+    size_t begin = 0;
+    for (size_t level = 1; level < pinned_levels_; level++) {
+        size_t end = pinned_.size();
+        size_t children = 0;
+        for (size_t i = begin; i < end; i++) {
+            children += pinned_[i].page_->as_internal().size_;
+        }
+        if (end + children > pinned_budget_ || buffer_.get_page(pinned_[begin].page_->as_internal().ch_[0])->type() != PageType::Internal) {
+            break;
+        }
+        pinned_.reserve(end + children);
+        for (size_t i = begin; i < end; i++) {
+            const INTERNAL_PAGE_TYPE& node = pinned_[i].page_->as_internal();
+            pinned_[i].first_ = static_cast<uint32_t>(pinned_.size());
+            pinned_[i].count_ = static_cast<uint32_t>(node.size_);
+            for (size_t c = 0; c < node.size_; c++) {
+                pinned_.push_back({buffer_.get_page(node.ch_[c]), PINNED_NONE, 0});
+            }
+        }
+        begin = end;
+    }
+    buffer_.set_pinned(pinned_.size());
+}
+
+BPT_TEMPLATE_ARGS
+const PAGE_TYPE* BPT_TYPE::pinned_page(diskpos_t pos, int slot, uint32_t& at) {
+    if (at == PINNED_NONE) {
+        return nullptr;
+    }
+    if (at == PINNED_ROOT) {
+        if (pinned_levels_ == 0) {
+            at = PINNED_NONE;
+            return nullptr;
+        }
+        if (pinned_stale_ || pinned_root_ != root_) {
+            pin_levels();
+        }
+        at = pinned_.empty() ? PINNED_NONE : 0;
+    }
+    else {
+        const PinnedPage& parent = pinned_[at];
+        at = (parent.first_ != PINNED_NONE && slot < static_cast<int>(parent.count_)) ? parent.first_ + slot : PINNED_NONE;
+    }
+    if (at == PINNED_NONE) {
+        return nullptr;
+    }
+    const PinnedPage& entry = pinned_[at];
+    if (entry.page_.pos() != pos || entry.page_->type() != PageType::Internal) {
+        pinned_stale_ = true;
+        at = PINNED_NONE;
+        return nullptr;
+    }
+    return entry.page_.get();
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::split(std::vector<PathEntry>& path, const std::vector<KEYPAIR_TYPE>& entries) {
+    for (int level = static_cast<int>(path.size()) - 1; level >= 0; level--) {
+        diskpos_t cur_pos = path[level].pos_;
+        auto cur_page = buffer_.get_page_mutable(cur_pos);
+        PAGE_TYPE new_page;
+        diskpos_t newp_pos;
+        KEYPAIR_TYPE split_at;
+        KEYPAIR_TYPE max_pair;
+        if (cur_page->type() == PageType::Leaf) {
+            LEAF_PAGE_TYPE& cur = cur_page->as_leaf();
+            LEAF_PAGE_TYPE& newp = new_page.init_leaf();
+            size_t half = LEAF_RUN_TYPE(entries.data(), entries.size()).split_point();
+            cur.assign(entries.data(), half);
+            newp.assign(entries.data() + half, entries.size() - half);
+            newp.left_ = cur_pos;
+            newp.right_ = cur.right_;
+            split_at = entries[half - 1];
+            max_pair = entries.back();
+            newp_pos = buffer_.insert_page(new_page);
+            if (cur.right_ != -1) {
+                auto rp = buffer_.get_page_mutable(cur.right_);
+                rp->as_leaf().left_ = newp_pos;
+            }
+            cur.right_ = newp_pos;
+        }
+        else {
+            INTERNAL_PAGE_TYPE& cur = cur_page->as_internal();
+            INTERNAL_PAGE_TYPE& newp = new_page.init_internal();
+            size_t half = cur.size_ / 2;
+            newp.size_ = cur.size_ - half;
+            for (int i = 0; i < static_cast<int>(newp.size_); i++) {
+                newp.set_at(i, cur.data_[i + half]);
+                newp.ch_[i] = cur.ch_[i + half];
+            }
+            cur.size_ = half;
+            cur.refresh_prefix();
+            split_at = cur.back();
+            max_pair = newp.back();
+            newp_pos = buffer_.insert_page(new_page);
+        }
+        splits_++;
+        if (level == 0) {
+            PAGE_TYPE new_root;
+            INTERNAL_PAGE_TYPE& newr = new_root.init_internal();
+            newr.size_ = 2;
+            newr.set_at(0, split_at);
+            newr.set_at(1, max_pair);
+            newr.ch_[0] = cur_pos;
+            newr.ch_[1] = newp_pos;
+            root_ = buffer_.insert_page(new_root);
+            return;
+        }
+        diskpos_t parent_pos = path[level - 1].pos_;
+        int slot = path[level].slot_;
+        auto f_page = buffer_.get_page_mutable(parent_pos);
+        INTERNAL_PAGE_TYPE& f = f_page->as_internal();
+        f.insert_at(slot, split_at, cur_pos);
+        f.ch_[slot + 1] = newp_pos;
+        bool need_split_parent = (f.size_ == INTERNAL_PAGE_TYPE::SLOT_COUNT);
+        if (!need_split_parent) {
+            return;
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::insert(const KeyType& key, const ValueType& val) {
+    OpTimer timer(this, OpKind::Insert);
+    KEYPAIR_TYPE kp(key, val);
+    // The key enters the filter before the tree, so a reader that finds it also passes the filter.
+    note_key(key);
+    if (buffer_.concurrent()) {
+        write_latched(kp, false);
+        return;
+    }
+    if (buffered_) {
+        make_room(true);
+    }
+    buffer_.log_op(LogType::Insert, kp);
+    insert_entry(kp);
+    buffer_.end_op(root_);
+    grow_bloom();
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::insert_entry(const KEYPAIR_TYPE& kp) {
+    if ((buffered_ || pending_ > 0) && push_message(kp, MessageOp::Insert)) {
+        return;
+    }
+    if (root_ == 0) {
+        PAGE_TYPE new_root;
+        LEAF_PAGE_TYPE& newr = new_root.init_leaf();
+        newr.assign(&kp, 1);
+        root_ = buffer_.insert_page(new_root);
+        return;
+    }
+    std::vector<PathEntry> path;
+    descend(kp, path);
+    insert_leaf(path, kp);
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::insert_leaf(std::vector<PathEntry>& path, const KEYPAIR_TYPE& kp) {
+    diskpos_t leaf_pos = path.back().pos_;
+    int idx = 0;
+    {
+        // Duplicates are rejected on the read-only handle, so they leave the page clean.
+        auto cur_page = buffer_.get_page(leaf_pos);
+        const LEAF_PAGE_TYPE& leaf = cur_page->as_leaf();
+        if (leaf.size_ > 0) {
+            int k = leaf.lower_bound(kp);
+            const KEYPAIR_TYPE& found = leaf.at(k);
+            if (found == kp) {
+                return false;
+            }
+            idx = (found < kp) ? k + 1 : k;
+        }
+    }
+    auto cur_mut = buffer_.get_page_mutable(leaf_pos);
+    LEAF_PAGE_TYPE& leaf = cur_mut->as_leaf();
+    bool inserted = leaf.insert_at(idx, kp);
+    if (inserted && !leaf.overfull()) {
+        return true;
+    }
+    // A packed leaf may run out of bytes before the entry lands; split the combined run instead.
+    std::vector<KEYPAIR_TYPE> entries;
+    entries.reserve(leaf.size_ + 1);
+    leaf.append_to(entries);
+    if (!inserted) {
+        entries.insert(entries.begin() + idx, kp);
+    }
+    split(path, entries);
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::erase(const KeyType& key, const ValueType& val) {
+    OpTimer timer(this, OpKind::Erase);
+    KEYPAIR_TYPE kp(key, val);
+    if (buffer_.concurrent()) {
+        write_latched(kp, true);
+        return;
+    }
+    if (buffered_) {
+        make_room(true);
+    }
+    buffer_.log_op(LogType::Erase, kp);
+    erase_entry(kp);
+    buffer_.end_op(root_);
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::erase_entry(const KEYPAIR_TYPE& kp) {
+    if ((buffered_ || pending_ > 0) && push_message(kp, MessageOp::Erase)) {
+        return;
+    }
+    if (root_ == 0) {
+        return;
+    }
+    std::vector<PathEntry> path;
+    descend(kp, path);
+    erase_leaf(path, kp);
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::erase_leaf(std::vector<PathEntry>& path, const KEYPAIR_TYPE& kp) {
+    diskpos_t leaf_pos = path.back().pos_;
+    auto cur_page = buffer_.get_page(leaf_pos);
+    int k = cur_page->as_leaf().lower_bound(kp);
+    if (cur_page->header().size_ == 0 || cur_page->as_leaf().at(k) != kp) {
+        return false;
+    }
+    auto cur_mut = buffer_.get_page_mutable(leaf_pos);
+    LEAF_PAGE_TYPE& leaf = cur_mut->as_leaf();
+    leaf.erase_at(k);
+    bool need_balance = leaf.underfull();
+    if (need_balance) {
+        balance(path);
+    }
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::push_message(const KEYPAIR_TYPE& kp, MessageOp op) {
+    make_room(false);
+    if (root_ == 0 || buffer_.get_page(root_)->type() == PageType::Leaf) {
+        return false;
+    }
+    auto root = buffer_.get_page_mutable(root_);
+    pending_ += root->as_internal().put_message(kp, op);
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::make_room(bool settle) {
+    std::vector<PathEntry> path;
+    while (root_ != 0) {
+        auto root = buffer_.get_page(root_);
+        if (root->type() == PageType::Leaf || room(root->as_internal()) > 0) {
+            return;
+        }
+        root.reset();
+        path.assign(1, {root_, -1});
+        flush(path);
+        shrink_root();
+        if (settle) {
+            buffer_.settle(root_);
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::flush(std::vector<PathEntry>& path) {
+    diskpos_t pos = path.back().pos_;
+    auto page = buffer_.get_page(pos);
+    const INTERNAL_PAGE_TYPE& node = page->as_internal();
+    // Messages are sorted, so the batch for each child is a contiguous run.
+    size_t from = 0;
+    size_t count = 0;
+    int slot = 0;
+    for (size_t i = 0; i < node.messages_;) {
+        int c = node.lower_bound(node.message_at(i));
+        size_t j = (c + 1 == static_cast<int>(node.size_)) ? node.messages_ : node.message_upper_bound(node.data_[c]);
+        if (j - i > count) {
+            from = i;
+            count = j - i;
+            slot = c;
+        }
+        i = j;
+    }
+    diskpos_t child_pos = node.ch_[slot];
+    page.reset();
+    path.push_back({child_pos, slot});
+    auto child = buffer_.get_page(child_pos);
+    bool leaf = (child->type() == PageType::Leaf);
+    if (!leaf) {
+        const INTERNAL_PAGE_TYPE& c = child->as_internal();
+        if (room(c) < count && c.messages_ > 0) {
+            child.reset();
+            flush(path);
+            return;
+        }
+        count = std::min(count, room(c));
+    }
+    child.reset();
+    std::vector<Message> batch;
+    buffer_.get_page_mutable(pos)->as_internal().take_messages(from, from + count, batch);
+    if (leaf) {
+        pending_ -= batch.size();
+        apply_messages(path, batch);
+        return;
+    }
+    auto child_mut = buffer_.get_page_mutable(child_pos);
+    INTERNAL_PAGE_TYPE& c = child_mut->as_internal();
+    for (const Message& m : batch) {
+        // A message replaced below is superseded and leaves the count.
+        pending_ -= !c.put_message(m.first, m.second);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::apply_messages(std::vector<PathEntry>& path, const std::vector<Message>& batch) {
+    diskpos_t leaf_pos = path.back().pos_;
+    std::vector<KEYPAIR_TYPE> existing;
+    buffer_.get_page(leaf_pos)->as_leaf().append_to(existing);
+    std::vector<KEYPAIR_TYPE> merged;
+    merged.reserve(existing.size() + batch.size());
+    bool changed = false;
+    size_t p = 0;
+    for (const Message& m : batch) {
+        while (p < existing.size() && existing[p] < m.first) {
+            merged.push_back(existing[p++]);
+        }
+        bool found = (p < existing.size() && existing[p] == m.first);
+        if (m.second == MessageOp::Insert) {
+            merged.push_back(m.first);
+        }
+        changed = changed || (found != (m.second == MessageOp::Insert));
+        p += found;
+    }
+    if (!changed) {
+        return;
+    }
+    merged.insert(merged.end(), existing.begin() + p, existing.end());
+    if (!LEAF_RUN_TYPE(merged.data(), merged.size()).fits(0, merged.size())) {
+        overflow(path, merged);
+        return;
+    }
+    auto leaf_mut = buffer_.get_page_mutable(leaf_pos);
+    LEAF_PAGE_TYPE& leaf = leaf_mut->as_leaf();
+    leaf.assign(merged.data(), merged.size());
+    bool need_balance = leaf.underfull();
+    if (need_balance) {
+        balance(path);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::apply_pending() {
+    std::vector<PathEntry> path;
+    while (pending_ > 0) {
+        path.clear();
+        if (!find_messages(root_, -1, internal_levels(), path)) {
+            break;
+        }
+        flush(path);
+        shrink_root();
+        buffer_.settle(root_);
+    }
+    shrink_root();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::internal_levels() {
+    size_t levels = 0;
+    for (diskpos_t pos = root_; pos != 0; levels++) {
+        auto page = buffer_.get_page(pos);
+        if (page->type() == PageType::Leaf) {
+            break;
+        }
+        pos = page->as_internal().ch_[0];
+    }
+    return levels;
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::room(const INTERNAL_PAGE_TYPE& node) const {
+    size_t cap = INTERNAL_PAGE_TYPE::SLOT_COUNT - (buffered_ ? fanout_ : 0);
+    return std::min(node.free_slots(), cap > node.messages_ ? cap - node.messages_ : 0);
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::fits_messages(diskpos_t pos, size_t children, size_t messages) {
+    auto page = buffer_.get_page(pos);
+    const INTERNAL_PAGE_TYPE& node = page->as_internal();
+    return room(node) >= messages && node.free_slots() >= children + messages;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::find_messages(diskpos_t pos, int slot, size_t levels, std::vector<PathEntry>& path) {
+    if (levels == 0) {
+        return false;
+    }
+    path.push_back({pos, slot});
+    auto page = buffer_.get_page(pos);
+    const INTERNAL_PAGE_TYPE& node = page->as_internal();
+    if (node.messages_ > 0) {
+        return true;
+    }
+    for (int c = 0; levels > 1 && c < static_cast<int>(node.size_); c++) {
+        if (find_messages(node.ch_[c], c, levels - 1, path)) {
+            return true;
+        }
+    }
+    path.pop_back();
+    return false;
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::count_messages(diskpos_t pos, size_t levels) {
+    if (levels == 0) {
+        return 0;
+    }
+    auto page = buffer_.get_page(pos);
+    const INTERNAL_PAGE_TYPE& node = page->as_internal();
+    size_t count = node.messages_;
+    for (int c = 0; levels > 1 && c < static_cast<int>(node.size_); c++) {
+        count += count_messages(node.ch_[c], levels - 1);
+    }
+    return count;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::shrink_root() {
+    while (root_ != 0) {
+        auto page = buffer_.get_page(root_);
+        diskpos_t pos = root_;
+        if (page->type() == PageType::Leaf) {
+            if (page->header().size_ == 0) {
+                page.reset();
+                root_ = 0;
+                buffer_.free_page(pos);
+            }
+            return;
+        }
+        const INTERNAL_PAGE_TYPE& node = page->as_internal();
+        if (node.size_ != 1 || node.messages_ > 0) {
+            return;
+        }
+        root_ = node.ch_[0];
+        page.reset();
+        buffer_.free_page(pos);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::gather(diskpos_t pos, const KeyType& key, std::vector<KEYPAIR_TYPE>& out) {
+    auto page = buffer_.get_page(pos);
+    if (page->type() == PageType::Leaf) {
+        const LEAF_PAGE_TYPE& leaf = page->as_leaf();
+        if (leaf.size_ == 0) {
+            return;
+        }
+        int k = leaf.lower_bound(key);
+        if (ordered_less(leaf.at(k).key_, key)) {
+            k++;
+        }
+        for (; k < static_cast<int>(leaf.size_) && !ordered_less(key, leaf.at(k).key_); k++) {
+            out.push_back(leaf.at(k));
+        }
+        return;
+    }
+    const INTERNAL_PAGE_TYPE& node = page->as_internal();
+    for (int c = node.lower_bound(key); c <= node.upper_bound(key); c++) {
+        gather(node.ch_[c], key, out);
+    }
+    for (size_t i = node.message_lower_bound(key); i < node.message_upper_bound(key); i++) {
+        const KEYPAIR_TYPE& kp = node.message_at(i);
+        auto it = std::lower_bound(out.begin(), out.end(), kp);
+        bool found = (it != out.end() && *it == kp);
+        if (node.message_op(i) == MessageOp::Insert && !found) {
+            out.insert(it, kp);
+        }
+        else if (node.message_op(i) == MessageOp::Erase && found) {
+            out.erase(it);
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::safe(const PAGE_TYPE& page, bool erase, bool is_root) {
+    size_t size = page.header().size_;
+    if (page.type() == PageType::Leaf) {
+        if (!erase) {
+            return page.as_leaf().safe_insert();
+        }
+        return is_root ? size > 1 : page.as_leaf().safe_erase();
+    }
+    if (!erase) {
+        return size + 1 < INTERNAL_PAGE_TYPE::SLOT_COUNT;
+    }
+    if (is_root) {
+        return size > 2;
+    }
+    return size > INTERNAL_PAGE_TYPE::SLOT_COUNT / 2;
+}
+
+BPT_TEMPLATE_ARGS
+int BPT_TYPE::write_optimistic(const KEYPAIR_TYPE& kp, bool erase) {
+    std::shared_lock<Latch> root_lock(root_latch_);
+    if (root_ == 0) {
+        return -1;
+    }
+    diskpos_t pos = root_;
+    ConstHandle parent;
+    ConstHandle page = buffer_.get_page(pos);
+    page.latch(false);
+    while (page->type() != PageType::Leaf) {
+        if (root_lock.owns_lock()) {
+            root_lock.unlock();
+        }
+        const INTERNAL_PAGE_TYPE& node = page->as_internal();
+        pos = node.ch_[node.lower_bound(kp)];
+        ConstHandle child = buffer_.get_page(pos);
+        child.latch(false);
+        parent = std::move(page);
+        page = std::move(child);
+    }
+    page.unlatch();
+    page.latch(true);
+    const LEAF_PAGE_TYPE& leaf = page->as_leaf();
+    int k = leaf.lower_bound(kp);
+    bool found = leaf.size_ > 0 && leaf.at(k) == kp;
+    if (found == erase && !safe(*page, erase, !parent)) {
+        return -1;
+    }
+    parent.reset();
+    if (root_lock.owns_lock()) {
+        root_lock.unlock();
+    }
+    std::vector<PathEntry> path{{pos, -1}};
+    return erase ? erase_leaf(path, kp) : insert_leaf(path, kp);
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::write_pessimistic(const KEYPAIR_TYPE& kp, bool erase) {
+    std::unique_lock<Latch> root_lock(root_latch_);
+    if (root_ == 0) {
+        if (erase) {
+            return false;
+        }
+        insert_entry(kp);
+        return true;
+    }
+    std::vector<PathEntry> path{{root_, -1}};
+    std::vector<ConstHandle> held;
+    ConstHandle cur = buffer_.get_page(root_);
+    cur.latch(true);
+    bool is_root = true;
+    diskpos_t edge = -1;
+    if (safe(*cur, erase, true)) {
+        root_lock.unlock();
+    }
+    while (cur->type() != PageType::Leaf) {
+        const INTERNAL_PAGE_TYPE& node = cur->as_internal();
+        int slot = node.lower_bound(kp);
+        diskpos_t child_pos = node.ch_[slot];
+        ConstHandle left;
+        ConstHandle right;
+        if (erase && slot > 0) {
+            left = buffer_.get_page(node.ch_[slot - 1]);
+            left.latch(true);
+        }
+        ConstHandle child = buffer_.get_page(child_pos);
+        child.latch(true);
+        if (erase && slot + 1 < static_cast<int>(node.size_)) {
+            right = buffer_.get_page(node.ch_[slot + 1]);
+            right.latch(true);
+        }
+        is_root = false;
+        held.push_back(std::move(cur));
+        if (safe(*child, erase, false)) {
+            held.clear();
+            path.clear();
+            if (root_lock.owns_lock()) {
+                root_lock.unlock();
+            }
+            edge = -1;
+        }
+        else {
+            if (child->type() == PageType::Leaf) {
+                edge = right ? right->as_leaf().right_ : child->as_leaf().right_;
+            }
+            held.push_back(std::move(left));
+            held.push_back(std::move(right));
+        }
+        path.push_back({child_pos, slot});
+        cur = std::move(child);
+    }
+    if (is_root) {
+        edge = safe(*cur, erase, true) ? -1 : cur->as_leaf().right_;
+    }
+    if (edge != -1) {
+        ConstHandle next = buffer_.get_page(edge);
+        next.latch(true);
+        held.push_back(std::move(next));
+    }
+    return erase ? erase_leaf(path, kp) : insert_leaf(path, kp);
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::write_latched(const KEYPAIR_TYPE& kp, bool erase) {
+    std::unique_lock<Latch> gate(write_gate_, std::defer_lock);
+    std::shared_lock<Latch> shared_gate(write_gate_, std::defer_lock);
+    if (buffer_.logging()) {
+        gate.lock();
+    }
+    else {
+        shared_gate.lock();
+    }
+    buffer_.log_op(erase ? LogType::Erase : LogType::Insert, kp);
+    int applied = write_optimistic(kp, erase);
+    if (applied < 0) {
+        applied = write_pessimistic(kp, erase);
+    }
+    if (buffer_.logging()) {
+        buffer_.end_op(root_);
+    }
+    return applied > 0;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::borrowl(INTERNAL_PAGE_TYPE& f, int k, diskpos_t cur_pos) {
+    if (k == 0) {
+        return false;
+    }
+    diskpos_t bpos = f.ch_[k - 1];
+    auto bro_page = buffer_.get_page(bpos);
+    if (bro_page->type() == PageType::Leaf) {
+        std::vector<KEYPAIR_TYPE> entries;
+        bro_page->as_leaf().append_to(entries);
+        size_t cut = entries.size();
+        buffer_.get_page(cur_pos)->as_leaf().append_to(entries);
+        LEAF_RUN_TYPE run(entries.data(), entries.size());
+        size_t moved = run.take_from_left(cut);
+        if (moved == 0) {
+            return false;
+        }
+        auto cur_page = buffer_.get_page_mutable(cur_pos);
+        auto bro_mut = buffer_.get_page_mutable(bpos);
+        cur_page->as_leaf().assign(entries.data() + cut - moved, entries.size() - cut + moved);
+        bro_mut->as_leaf().assign(entries.data(), cut - moved);
+        f.set_at(k - 1, entries[cut - moved - 1]);
+        borrows_++;
+        return !run.underfull(cut - moved, entries.size());
+    }
+    if (bro_page->header().size_ <= fanout_ / 2) {
+        return false;
+    }
+    // Messages bound for the moved child go with it.
+    const INTERNAL_PAGE_TYPE& bro_node = bro_page->as_internal();
+    size_t from = bro_node.message_upper_bound(bro_node.data_[bro_node.size_ - 2]);
+    if (!fits_messages(cur_pos, 1, bro_node.messages_ - from)) {
+        return false;
+    }
+    auto cur_page = buffer_.get_page_mutable(cur_pos);
+    auto bro_mut = buffer_.get_page_mutable(bpos);
+    INTERNAL_PAGE_TYPE& cur = cur_page->as_internal();
+    INTERNAL_PAGE_TYPE& bro = bro_mut->as_internal();
+    if (from < bro.messages_) {
+        std::vector<Message> msgs;
+        bro.take_messages(from, bro.messages_, msgs);
+        cur.take_messages(0, cur.messages_, msgs);
+        cur.assign_messages(msgs.data(), msgs.size());
+    }
+    cur.insert_at(0, f.data_[k - 1], bro.ch_[bro.size_ - 1]);
+    bro.size_--;
+    bro.refresh_prefix();
+    f.set_at(k - 1, bro.back());
+    borrows_++;
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::borrowr(INTERNAL_PAGE_TYPE& f, int k, diskpos_t cur_pos) {
+    if (k == static_cast<int>(f.size_) - 1) {
+        return false;
+    }
+    diskpos_t bpos = f.ch_[k + 1];
+    auto bro_page = buffer_.get_page(bpos);
+    if (bro_page->type() == PageType::Leaf) {
+        std::vector<KEYPAIR_TYPE> entries;
+        buffer_.get_page(cur_pos)->as_leaf().append_to(entries);
+        size_t cut = entries.size();
+        bro_page->as_leaf().append_to(entries);
+        LEAF_RUN_TYPE run(entries.data(), entries.size());
+        size_t moved = run.take_from_right(cut);
+        if (moved == 0) {
+            return false;
+        }
+        auto cur_page = buffer_.get_page_mutable(cur_pos);
+        auto bro_mut = buffer_.get_page_mutable(bpos);
+        cur_page->as_leaf().assign(entries.data(), cut + moved);
+        bro_mut->as_leaf().assign(entries.data() + cut + moved, entries.size() - cut - moved);
+        f.set_at(k, entries[cut + moved - 1]);
+        borrows_++;
+        return !run.underfull(0, cut + moved);
+    }
+    if (bro_page->header().size_ <= fanout_ / 2) {
+        return false;
+    }
+    const INTERNAL_PAGE_TYPE& bro_node = bro_page->as_internal();
+    size_t to = bro_node.message_upper_bound(bro_node.data_[0]);
+    if (!fits_messages(cur_pos, 1, to)) {
+        return false;
+    }
+    auto cur_page = buffer_.get_page_mutable(cur_pos);
+    auto bro_mut = buffer_.get_page_mutable(bpos);
+    INTERNAL_PAGE_TYPE& cur = cur_page->as_internal();
+    INTERNAL_PAGE_TYPE& bro = bro_mut->as_internal();
+    if (to > 0) {
+        std::vector<Message> msgs;
+        cur.take_messages(0, cur.messages_, msgs);
+        bro.take_messages(0, to, msgs);
+        cur.assign_messages(msgs.data(), msgs.size());
+    }
+    cur.set_at(cur.size_ - 1, f.data_[k]);
+    cur.insert_at(cur.size_, bro.data_[0], bro.ch_[0]);
+    f.set_at(k, bro.data_[0]);
+    bro.erase_at(0);
+    borrows_++;
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::merge(INTERNAL_PAGE_TYPE& f, int k) {
+    int j;
+    if (k) {
+        j = k - 1;
+    }
+    else if (k != static_cast<int>(f.size_) - 1) {
+        j = k;
+    }
+    else {
+        return false;
+    }
+    diskpos_t lpos = f.ch_[j];
+    diskpos_t rpos = f.ch_[j + 1];
+    auto r_page = buffer_.get_page(rpos);
+    if (r_page->type() == PageType::Leaf) {
+        const LEAF_PAGE_TYPE& r = r_page->as_leaf();
+        std::vector<KEYPAIR_TYPE> entries;
+        buffer_.get_page(lpos)->as_leaf().append_to(entries);
+        r.append_to(entries);
+        // Packed halves can lose their shared prefix when joined; such pairs stay apart.
+        if (!LEAF_RUN_TYPE(entries.data(), entries.size()).fits(0, entries.size())) {
+            return false;
+        }
+        auto l_page = buffer_.get_page_mutable(lpos);
+        LEAF_PAGE_TYPE& l = l_page->as_leaf();
+        l.assign(entries.data(), entries.size());
+        l.right_ = r.right_;
+        if (r.right_ != -1) {
+            auto rp = buffer_.get_page_mutable(r.right_);
+            rp->as_leaf().left_ = lpos;
+        }
+    }
+    else {
+        const INTERNAL_PAGE_TYPE& r = r_page->as_internal();
+        if (!fits_messages(lpos, r.size_, r.messages_)) {
+            return false;
+        }
+        auto l_page = buffer_.get_page_mutable(lpos);
+        INTERNAL_PAGE_TYPE& l = l_page->as_internal();
+        if (r.messages_ > 0) {
+            std::vector<Message> msgs;
+            l.take_messages(0, l.messages_, msgs);
+            for (size_t i = 0; i < r.messages_; i++) {
+                msgs.push_back({r.message_at(i), r.message_op(i)});
+            }
+            l.assign_messages(msgs.data(), msgs.size());
+        }
+        l.set_at(l.size_ - 1, f.data_[j]);
+        for (int i = 0; i < static_cast<int>(r.size_); i++) {
+            l.set_at(l.size_ + i, r.data_[i]);
+            l.ch_[l.size_ + i] = r.ch_[i];
+        }
+        l.size_ += r.size_;
+        l.refresh_prefix();
+    }
+    f.ch_[j + 1] = lpos;
+    f.erase_at(j);
+    buffer_.free_page(rpos);
+    merges_++;
+    return true;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::balance(std::vector<PathEntry>& path) {
+    for (int level = static_cast<int>(path.size()) - 1; level >= 0; level--) {
+        diskpos_t cur_pos = path[level].pos_;
+        if (level == 0) {
+            auto cur_page = buffer_.get_page(cur_pos);
+            if (cur_page->header().size_ == 0) {
+                root_ = 0;
+                buffer_.free_page(cur_pos);
+            }
+            else if (cur_page->type() == PageType::Internal && cur_page->header().size_ == 1 && cur_page->as_internal().messages_ == 0) {
+                root_ = cur_page->as_internal().ch_[0];
+                buffer_.free_page(cur_pos);
+            }
+            return;
+        }
+        diskpos_t fpos = path[level - 1].pos_;
+        int k = path[level].slot_;
+        auto f_page = buffer_.get_page_mutable(fpos);
+        INTERNAL_PAGE_TYPE& f = f_page->as_internal();
+        bool need_balance = false;
+        if (!borrowl(f, k, cur_pos) && !borrowr(f, k, cur_pos)) {
+            need_balance = merge(f, k) && f.size_ < fanout_ / 2;
+        }
+        if (!need_balance) {
+            return;
+        }
+    }
+}
+
+BPT_TEMPLATE_ARGS
+std::vector<size_t> BPT_TYPE::even_chunks(size_t n, size_t capacity, size_t at_least) {
+    size_t target = capacity * 3 / 4;
+    size_t k = std::max((n + target - 1) / target, at_least);
+    std::vector<size_t> sizes(k, n / k);
+    for (size_t i = 0; i < n % k; i++) {
+        sizes[i]++;
+    }
+    return sizes;
+}
+
+BPT_TEMPLATE_ARGS
+std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> BPT_TYPE::write_internal_chunks(const std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>>& entries, diskpos_t first_pos) {
+    std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> ups;
+    std::vector<Message> msgs;
+    if (first_pos != -1) {
+        auto first_page = buffer_.get_page_mutable(first_pos);
+        INTERNAL_PAGE_TYPE& first = first_page->as_internal();
+        first.take_messages(0, first.messages_, msgs);
+    }
+    // Messages follow their children. A chunk whose share does not fit beside its children
+    // means more, smaller chunks; with one child each every share fits.
+    std::vector<size_t> sizes;
+    std::vector<size_t> cuts;
+    for (size_t at_least = 1; ; at_least = sizes.size() + 1) {
+        sizes = even_chunks(entries.size(), fanout_, at_least);
+        cuts.clear();
+        size_t end = 0;
+        size_t m = 0;
+        for (size_t c = 0; c < sizes.size(); c++) {
+            end += sizes[c];
+            size_t next = msgs.size();
+            if (c + 1 < sizes.size()) {
+                while (m < msgs.size() && !(entries[end - 1].first < msgs[m].first)) {
+                    m++;
+                }
+                next = m;
+            }
+            size_t start = cuts.empty() ? 0 : cuts.back();
+            if (sizes[c] + next - start > INTERNAL_PAGE_TYPE::SLOT_COUNT) {
+                break;
+            }
+            cuts.push_back(next);
+        }
+        if (cuts.size() == sizes.size()) {
+            break;
+        }
+    }
+    size_t idx = 0;
+    for (size_t c = 0; c < sizes.size(); c++) {
+        size_t size = sizes[c];
+        PAGE_TYPE new_page;
+        bool reuse = ups.empty() && first_pos != -1;
+        typename BUFFER_MANAGER_TYPE::MutHandle first_page;
+        if (reuse) {
+            first_page = buffer_.get_page_mutable(first_pos);
+        }
+        INTERNAL_PAGE_TYPE& node = reuse ? first_page->as_internal() : new_page.init_internal();
+        for (size_t i = 0; i < size; i++) {
+            node.set_at(i, entries[idx + i].first);
+            node.ch_[i] = entries[idx + i].second;
+        }
+        node.size_ = size;
+        node.refresh_prefix();
+        idx += size;
+        size_t start = c ? cuts[c - 1] : 0;
+        node.assign_messages(msgs.data() + start, cuts[c] - start);
+        if (reuse) {
+            ups.push_back({node.back(), first_pos});
+        }
+        else {
+            ups.push_back({node.back(), buffer_.insert_page(new_page)});
+        }
+    }
+    splits_ += ups.size() - (first_pos != -1 ? 1 : 0);
+    return ups;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::overflow(std::vector<PathEntry>& path, const std::vector<KEYPAIR_TYPE>& entries) {
+    std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> ups;
+    diskpos_t cur_pos = path.back().pos_;
+    auto cur_page = buffer_.get_page_mutable(cur_pos);
+    LEAF_PAGE_TYPE& cur = cur_page->as_leaf();
+    std::vector<size_t> sizes = LEAF_RUN_TYPE(entries.data(), entries.size()).chunks();
+    std::vector<diskpos_t> pos(sizes.size(), cur_pos);
+    for (size_t c = 1; c < sizes.size(); c++) {
+        pos[c] = buffer_.allocate_page();
+    }
+    diskpos_t right = cur.right_;
+    size_t idx = 0;
+    for (size_t c = 0; c < sizes.size(); c++) {
+        PAGE_TYPE new_page;
+        LEAF_PAGE_TYPE& leaf = c ? new_page.init_leaf() : cur;
+        leaf.assign(entries.data() + idx, sizes[c]);
+        idx += sizes[c];
+        if (c) {
+            leaf.left_ = pos[c - 1];
+        }
+        leaf.right_ = (c + 1 < sizes.size()) ? pos[c + 1] : right;
+        ups.push_back({entries[idx - 1], pos[c]});
+        if (c) {
+            buffer_.insert_page(pos[c], new_page);
+        }
+    }
+    if (right != -1) {
+        auto rp = buffer_.get_page_mutable(right);
+        rp->as_leaf().left_ = pos.back();
+    }
+    splits_ += sizes.size() - 1;
+    for (int level = static_cast<int>(path.size()) - 2; level >= 0 && ups.size() > 1; level--) {
+        diskpos_t parent_pos = path[level].pos_;
+        int slot = path[level + 1].slot_;
+        auto f_page = buffer_.get_page_mutable(parent_pos);
+        INTERNAL_PAGE_TYPE& f = f_page->as_internal();
+        ups.back().first = f.data_[slot];
+        std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> merged;
+        for (int i = 0; i < slot; i++) {
+            merged.push_back({f.data_[i], f.ch_[i]});
+        }
+        merged.insert(merged.end(), ups.begin(), ups.end());
+        for (int i = slot + 1; i < static_cast<int>(f.size_); i++) {
+            merged.push_back({f.data_[i], f.ch_[i]});
+        }
+        if (merged.size() < fanout_ && merged.size() + f.messages_ <= INTERNAL_PAGE_TYPE::SLOT_COUNT) {
+            for (size_t i = 0; i < merged.size(); i++) {
+                f.set_at(i, merged[i].first);
+                f.ch_[i] = merged[i].second;
+            }
+            f.size_ = merged.size();
+            f.refresh_prefix();
+            return;
+        }
+        ups = write_internal_chunks(merged, parent_pos);
+    }
+    while (ups.size() >= fanout_) {
+        ups = write_internal_chunks(ups, -1);
+    }
+    if (ups.size() > 1) {
+        PAGE_TYPE new_root;
+        INTERNAL_PAGE_TYPE& newr = new_root.init_internal();
+        for (size_t i = 0; i < ups.size(); i++) {
+            newr.set_at(i, ups[i].first);
+            newr.ch_[i] = ups[i].second;
+        }
+        newr.size_ = ups.size();
+        newr.refresh_prefix();
+        root_ = buffer_.insert_page(new_root);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+typename BPT_TYPE::BatchStats BPT_TYPE::insert_batch(std::vector<KEYPAIR_TYPE>& batch) {
+    BatchStats stats;
+    size_t fetches = buffer_.fetch_count();
+    size_t splits = splits_;
+    std::sort(batch.begin(), batch.end());
+    if (buffer_.concurrent()) {
+        for (const KEYPAIR_TYPE& kp : batch) {
+            note_key(kp.key_);
+            stats.applied_ += write_latched(kp, false);
+        }
+        stats.page_fetches_ = buffer_.fetch_count() - fetches;
+        stats.splits_ = splits_ - splits;
+        return stats;
+    }
+    if (buffered_) {
+        // Messages are not checked against the leaves, so every pair counts as applied.
+        for (const KEYPAIR_TYPE& kp : batch) {
+            insert(kp.key_, kp.val_);
+        }
+        stats.applied_ = batch.size();
+        stats.page_fetches_ = buffer_.fetch_count() - fetches;
+        stats.splits_ = splits_ - splits;
+        return stats;
+    }
+    std::vector<PathEntry> path;
+    std::vector<KEYPAIR_TYPE> existing;
+    std::vector<KEYPAIR_TYPE> merged;
+    size_t limit = buffer_.logging() ? buffer_.capacity() / 4 * (LEAF_PAGE_TYPE::SLOT_COUNT / 2) : batch.size();
+    size_t i = 0;
+    while (i < batch.size()) {
+        if (root_ == 0) {
+            insert(batch[i].key_, batch[i].val_);
+            stats.applied_++;
+            i++;
+            continue;
+        }
+        KEYPAIR_TYPE upper;
+        bool bounded = descend(batch[i], path, &upper);
+        size_t j = i;
+        while (j < batch.size() && j - i < limit && (!bounded || !(upper < batch[j]))) {
+            buffer_.log_op(LogType::Insert, batch[j]);
+            j++;
+        }
+        diskpos_t leaf_pos = path.back().pos_;
+        existing.clear();
+        buffer_.get_page(leaf_pos)->as_leaf().append_to(existing);
+        merged.clear();
+        size_t added = 0;
+        size_t p = 0;
+        for (size_t q = i; q < j; q++) {
+            if (q > i && batch[q] == batch[q - 1]) {
+                continue;
+            }
+            while (p < existing.size() && existing[p] < batch[q]) {
+                merged.push_back(existing[p++]);
+            }
+            if (p < existing.size() && existing[p] == batch[q]) {
+                continue;
+            }
+            merged.push_back(batch[q]);
+            added++;
+        }
+        if (added) {
+            while (p < existing.size()) {
+                merged.push_back(existing[p++]);
+            }
+            if (LEAF_RUN_TYPE(merged.data(), merged.size()).fits(0, merged.size())) {
+                auto leaf_mut = buffer_.get_page_mutable(leaf_pos);
+                leaf_mut->as_leaf().assign(merged.data(), merged.size());
+            }
+            else {
+                overflow(path, merged);
+            }
+        }
+        buffer_.end_op(root_);
+        stats.applied_ += added;
+        i = j;
+    }
+    // Nothing reads the filter concurrently here, so the keys can go in after the leaves.
+    for (const KEYPAIR_TYPE& kp : batch) {
+        note_key(kp.key_);
+    }
+    grow_bloom();
+    stats.page_fetches_ = buffer_.fetch_count() - fetches;
+    stats.splits_ = splits_ - splits;
+    return stats;
+}
+
+BPT_TEMPLATE_ARGS
+typename BPT_TYPE::BatchStats BPT_TYPE::erase_batch(std::vector<KEYPAIR_TYPE>& batch) {
+    BatchStats stats;
+    size_t fetches = buffer_.fetch_count();
+    size_t merges = merges_;
+    std::sort(batch.begin(), batch.end());
+    if (buffer_.concurrent()) {
+        for (const KEYPAIR_TYPE& kp : batch) {
+            stats.applied_ += write_latched(kp, true);
+        }
+        stats.page_fetches_ = buffer_.fetch_count() - fetches;
+        stats.merges_ = merges_ - merges;
+        return stats;
+    }
+    if (buffered_) {
+        for (const KEYPAIR_TYPE& kp : batch) {
+            erase(kp.key_, kp.val_);
+        }
+        stats.applied_ = batch.size();
+        stats.page_fetches_ = buffer_.fetch_count() - fetches;
+        stats.merges_ = merges_ - merges;
+        return stats;
+    }
+    std::vector<PathEntry> path;
+    std::vector<KEYPAIR_TYPE> existing;
+    size_t i = 0;
+    while (i < batch.size() && root_ != 0) {
+        KEYPAIR_TYPE upper;
+        bool bounded = descend(batch[i], path, &upper);
+        size_t j = i;
+        while (j < batch.size() && (!bounded || !(upper < batch[j]))) {
+            buffer_.log_op(LogType::Erase, batch[j]);
+            j++;
+        }
+        diskpos_t leaf_pos = path.back().pos_;
+        existing.clear();
+        buffer_.get_page(leaf_pos)->as_leaf().append_to(existing);
+        size_t p = 0;
+        size_t q = i;
+        bool found = false;
+        while (p < existing.size() && q < j) {
+            if (existing[p] < batch[q]) {
+                p++;
+            }
+            else if (batch[q] < existing[p]) {
+                q++;
+            }
+            else {
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            size_t kept = p;
+            for (; p < existing.size(); p++) {
+                while (q < j && batch[q] < existing[p]) {
+                    q++;
+                }
+                if (q < j && batch[q] == existing[p]) {
+                    stats.applied_++;
+                    continue;
+                }
+                existing[kept++] = existing[p];
+            }
+            auto leaf_mut = buffer_.get_page_mutable(leaf_pos);
+            LEAF_PAGE_TYPE& dst = leaf_mut->as_leaf();
+            dst.assign(existing.data(), kept);
+            bool need_balance = dst.underfull();
+            if (need_balance) {
+                balance(path);
+            }
+        }
+        buffer_.end_op(root_);
+        i = j;
+    }
+    stats.page_fetches_ = buffer_.fetch_count() - fetches;
+    stats.merges_ = merges_ - merges;
+    return stats;
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::fill_count(size_t capacity, double fill_factor) {
+    size_t fill = static_cast<size_t>(capacity * fill_factor);
+    if (fill < capacity / 2) {
+        fill = capacity / 2;
+    }
+    if (fill > capacity - 1) {
+        fill = capacity - 1;
+    }
+    return fill;
+}
+
+BPT_TEMPLATE_ARGS
+std::vector<size_t> BPT_TYPE::chunk_sizes(size_t n, size_t fill, size_t capacity) {
+    std::vector<size_t> sizes(n / fill, fill);
+    if (n % fill) {
+        sizes.push_back(n % fill);
+    }
+    if (sizes.size() > 1 && sizes.back() < capacity / 2) {
+        size_t total = sizes.back() + fill;
+        sizes.pop_back();
+        if (total < capacity) {
+            sizes.back() = total;
+        }
+        else {
+            sizes.back() = total / 2;
+            sizes.push_back(total - total / 2);
+        }
+    }
+    return sizes;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::write_leaf(diskpos_t pos, const std::vector<KEYPAIR_TYPE>& entries, diskpos_t left, diskpos_t right) {
+    PAGE_TYPE page;
+    LEAF_PAGE_TYPE& leaf = page.init_leaf();
+    leaf.assign(entries.data(), entries.size());
+    leaf.left_ = left;
+    leaf.right_ = right;
+    buffer_.write_page(pos, page);
+}
+
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::build_internal_levels(std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>>& level, double fill_factor) {
+    size_t fill = fill_count(fanout_, fill_factor);
+    while (level.size() > 1) {
+        std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> next;
+        size_t idx = 0;
+        for (size_t size : chunk_sizes(level.size(), fill, fanout_)) {
+            PAGE_TYPE page;
+            INTERNAL_PAGE_TYPE& node = page.init_internal();
+            for (size_t i = 0; i < size; i++) {
+                node.set_at(i, level[idx + i].first);
+                node.ch_[i] = level[idx + i].second;
+            }
+            node.size_ = size;
+            node.refresh_prefix();
+            idx += size;
+            diskpos_t pos = buffer_.allocate_page();
+            buffer_.write_page(pos, page);
+            next.push_back({node.back(), pos});
+        }
+        level.swap(next);
+    }
+    return level[0].second;
+}
+
+BPT_TEMPLATE_ARGS
+template<typename Source>
+size_t BPT_TYPE::bulk_load(Source source, double fill_factor) {
+    KeyType key;
+    ValueType val;
+    size_t count = 0;
+    std::unique_lock<Latch> gate(write_gate_, std::defer_lock);
+    std::unique_lock<Latch> root_lock(root_latch_, std::defer_lock);
+    if (buffer_.concurrent()) {
+        gate.lock();
+        root_lock.lock();
+    }
+    if (root_ != 0) {
+        if (gate.owns_lock()) {
+            root_lock.unlock();
+            gate.unlock();
+        }
+        while (source(key, val)) {
+            insert(key, val);
+            count++;
+        }
+        return count;
+    }
+    buffer_.begin_unlogged();
+    size_t leaf_fill = fill_count(LEAF_PAGE_TYPE::MAX_WEIGHT + 1, fill_factor);
+    std::vector<std::pair<KEYPAIR_TYPE, diskpos_t>> level;
+    std::vector<KEYPAIR_TYPE> stragglers;
+    std::vector<KEYPAIR_TYPE> pending;
+    std::vector<KEYPAIR_TYPE> cur;
+    size_t cur_bytes = 0;
+    size_t cur_heads = 0;
+    diskpos_t pending_pos = -1;
+    diskpos_t pending_left = -1;
+    while (source(key, val)) {
+        KEYPAIR_TYPE kp(key, val);
+        count++;
+        note_key(key);
+        const std::vector<KEYPAIR_TYPE>* last = !cur.empty() ? &cur : (!pending.empty() ? &pending : nullptr);
+        if (last != nullptr && !(last->back() < kp)) {
+            if (last->back() != kp) {
+                stragglers.push_back(kp);
+            }
+            continue;
+        }
+        size_t len = LEAF_PAGE_TYPE::key_length(kp.key_);
+        bool head = cur.empty();
+        if constexpr (LEAF_PAGE_TYPE::COMPRESSED) {
+            head = head || !LEAF_PAGE_TYPE::same_key(cur.back().key_, LEAF_PAGE_TYPE::key_length(cur.back().key_), kp.key_, len);
+        }
+        if (!cur.empty() && LEAF_PAGE_TYPE::weight(cur.size() + 1, cur_heads + head, cur_bytes + (head ? len : 0),
+                                                   LEAF_PAGE_TYPE::common_prefix(cur.front().key_, kp.key_)) > leaf_fill) {
+            diskpos_t cur_pos = buffer_.allocate_page();
+            if (!pending.empty()) {
+                write_leaf(pending_pos, pending, pending_left, cur_pos);
+                level.push_back({pending.back(), pending_pos});
+            }
+            pending_left = pending_pos;
+            pending.swap(cur);
+            pending_pos = cur_pos;
+            cur.clear();
+            cur_bytes = 0;
+            cur_heads = 0;
+            head = true;
+        }
+        cur.push_back(kp);
+        if (head) {
+            cur_bytes += len;
+            cur_heads++;
+        }
+    }
+    if (cur.empty()) {
+        buffer_.end_unlogged(root_);
+        return count;
+    }
+    if (!pending.empty() && LEAF_RUN_TYPE(cur.data(), cur.size()).underfull(0, cur.size())) {
+        pending.insert(pending.end(), cur.begin(), cur.end());
+        LEAF_RUN_TYPE run(pending.data(), pending.size());
+        size_t keep = run.fits(0, pending.size()) ? pending.size() : run.split_point();
+        cur.assign(pending.begin() + keep, pending.end());
+        pending.resize(keep);
+    }
+    if (!cur.empty()) {
+        diskpos_t cur_pos = buffer_.allocate_page();
+        if (!pending.empty()) {
+            write_leaf(pending_pos, pending, pending_left, cur_pos);
+            level.push_back({pending.back(), pending_pos});
+        }
+        write_leaf(cur_pos, cur, pending_pos, -1);
+        level.push_back({cur.back(), cur_pos});
+    }
+    else {
+        write_leaf(pending_pos, pending, pending_left, -1);
+        level.push_back({pending.back(), pending_pos});
+    }
+    root_ = build_internal_levels(level, fill_factor);
+    buffer_.end_unlogged(root_);
+    if (gate.owns_lock()) {
+        root_lock.unlock();
+        gate.unlock();
+    }
+    grow_bloom();
+    for (const KEYPAIR_TYPE& kp : stragglers) {
+        insert(kp.key_, kp.val_);
+    }
+    return count;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::sync() {
+    std::unique_lock<Latch> gate(write_gate_, std::defer_lock);
+    if (buffer_.concurrent()) {
+        gate.lock();
+    }
+    buffer_.sync(root_);
+}
+
+BPT_TEMPLATE_ARGS
+IoBackend BPT_TYPE::io_backend() const {
+    return buffer_.io_backend();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::reused_pages() const {
+    return buffer_.reused_pages();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::appended_pages() const {
+    return buffer_.appended_pages();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::foreground_writes() const {
+    return buffer_.foreground_writes();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::background_writes() const {
+    return buffer_.background_writes();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::cache_hits() const {
+    return buffer_.cache_hits();
+}
+
+BPT_TEMPLATE_ARGS
+size_t BPT_TYPE::cache_misses() const {
+    return buffer_.cache_misses();
+}
+
+BPT_TEMPLATE_ARGS
+TreeStats BPT_TYPE::stats() {
+    TreeStats stats;
+    stats.buffer_ = buffer_.stats();
+    Cursor cursor;
+    seek(cursor, [](const INTERNAL_PAGE_TYPE&) {
+        return 0;
+    });
+    stats.height_ = cursor.pages_read();
+    stats.splits_ = splits_;
+    stats.merges_ = merges_;
+    stats.borrows_ = borrows_;
+    stats.pending_messages_ = pending_;
+    stats.pinned_pages_ = pinned_.size();
+    stats.pinned_bytes_ = pinned_.size() * sizeof(PAGE_TYPE) + pinned_.capacity() * sizeof(PinnedPage);
+    stats.bloom_bytes_ = bloom_.bytes();
+    stats.bloom_negatives_ = bloom_negatives_;
+    stats.histograms_ = histograms_;
+    if (histograms_) {
+        for (size_t i = 0; i < latency_.size(); i++) {
+            stats.latency_[i] = latency_[i].snapshot();
+        }
+    }
+    return stats;
 }
 
 } // namespace sjtu
 
-#endif // BPT_HPP
\ No newline at end of file
+#endif // BPT_HPP
@@ -1,42 +1,216 @@
 #ifndef BUFFER_HPP
 #define BUFFER_HPP
 
-#include <list>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "config.hpp"
 #include "page.hpp"
 #include "disk.hpp"
+#include "latch.hpp"
+#include "wal.hpp"
+#include "stats.hpp"
 
 namespace sjtu {
 #define BUFFER_MANAGER_TYPE BufferManager<KeyType, ValueType>
 #define BUFFER_MANAGER_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
 
+#define PAGE_HANDLE_TYPE BufferManager<KeyType, ValueType>::Handle<PageT>
+#define PAGE_HANDLE_TEMPLATE_ARGS template<typename KeyType, typename ValueType> template<typename PageT>
+
 BUFFER_MANAGER_TEMPLATE_ARGS
 class BufferManager {
+public:
+    template<typename PageT>
+    class Handle {
+    private:
+        BufferManager* buffer_ = nullptr;
+        uint32_t frame_ = 0;
+        PageT* page_ = nullptr;
+        uint8_t latched_ = 0;
+
+        Handle(BufferManager* buffer, uint32_t frame, PageT* page);
+
+        friend class BufferManager;
+
+    public:
+        Handle() = default;
+
+        Handle(const Handle& oth);
+
+        Handle(Handle&& oth) noexcept;
+
+        ~Handle();
+
+        Handle& operator=(Handle oth) noexcept;
+
+        PageT* operator->() const;
+
+        PageT& operator*() const;
+
+        PageT* get() const;
+
+        // Position of the page in the frame; -1 once that page was freed or written around the pool.
+        diskpos_t pos() const;
+
+        explicit operator bool() const;
+
+        void latch(bool exclusive);
+
+        bool try_latch(bool exclusive);
+
+        void unlatch();
+
+        void reset();
+    };
+
+    typedef Handle<const PAGE_TYPE> ConstHandle;
+    typedef Handle<PAGE_TYPE> MutHandle;
+
 private:
-    struct CacheEntry {
-        diskpos_t pos_;
-        std::shared_ptr<PAGE_TYPE> page_;
-        bool dirty_;
-        typename std::list<diskpos_t>::iterator lru_it_;
+    constexpr static uint32_t NIL = UINT32_MAX;
+
+    struct Frame {
+        diskpos_t pos_ = -1;
+        uint32_t pin_count_ = 0;
+        uint32_t part_ = 0;
+        bool dirty_ = false;
+        bool uncommitted_ = false;
+        bool prefetched_ = false;
+        uint32_t prev_ = NIL;
+        uint32_t next_ = NIL;
+    };
+
+    struct Slot {
+        diskpos_t pos_ = -1;
+        uint32_t frame_ = NIL;
+    };
+
+    struct Partition {
+        std::vector<uint32_t> free_frames_;
+        std::vector<Slot> table_;
+        uint32_t lru_head_ = NIL;
+        uint32_t lru_tail_ = NIL;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+        size_t evictions_ = 0;
+        size_t prefetched_ = 0;
+        size_t prefetch_hits_ = 0;
+        std::mutex latch_;
     };
+
     DiskManager<PAGE_TYPE> disk_;
-    std::unordered_map<diskpos_t, CacheEntry> cache_;
-    std::unordered_set<diskpos_t> cache_in_use_;
-    std::list<diskpos_t> lru_list_;
+    PAGE_TYPE* pages_ = nullptr;
+    std::vector<Frame> frames_;
+    std::unique_ptr<Partition[]> parts_;
+    size_t part_count_ = 1;
+    size_t table_mask_ = 0;
     size_t cache_capacity_;
+    size_t reserved_ = 0;
+    size_t pinned_ = 0;
+    std::atomic<size_t> used_frames_{0};
+    size_t dirty_count_ = 0;
+    size_t dirty_high_ = 0;
+    std::atomic<size_t> foreground_writes_{0};
+    size_t background_writes_ = 0;
+    size_t checkpoint_writes_ = 0;
+    size_t freed_pages_ = 0;
+    mutable std::mutex latch_;
+    bool concurrent_ = false;
+    std::unique_ptr<Latch[]> latches_;
+    std::condition_variable flush_cv_;
+    std::condition_variable io_cv_;
+    std::thread flusher_;
+    bool stop_ = false;
+    bool flush_wanted_ = false;
+    std::vector<diskpos_t> inflight_;
+    PAGE_TYPE* staging_ = nullptr;
+    LogManager<PAGE_TYPE> wal_;
+    bool logging_ = false;
+    bool unlogged_ = false;
+    size_t group_commit_ = 0;
+    size_t checkpoint_bytes_ = 0;
+    size_t ops_since_sync_ = 0;
+    size_t uncommitted_count_ = 0;
+    std::vector<uint32_t> uncommitted_;
+    std::vector<diskpos_t> pending_frees_;
+    std::vector<std::pair<LogType, KEYPAIR_TYPE>> redo_;
+
+    std::unique_lock<std::mutex> guard() const;
+
+    std::unique_lock<std::mutex> guard(Partition& part) const;
+
+    std::vector<std::unique_lock<std::mutex>> freeze() const;
+
+    Partition& part_of(diskpos_t pos) const;
+
+    size_t slot_of(diskpos_t pos) const;
+
+    uint32_t lookup(const Partition& part, diskpos_t pos) const;
+
+    void table_insert(Partition& part, diskpos_t pos, uint32_t frame);
+
+    void table_erase(Partition& part, diskpos_t pos);
+
+    void lru_unlink(Partition& part, uint32_t frame);
+
+    void lru_push_front(Partition& part, uint32_t frame);
+
+    void pin(Partition& part, uint32_t frame);
+
+    void unpin(Partition& part, uint32_t frame);
+
+    void retain(uint32_t frame);
+
+    void release(uint32_t frame);
+
+    void detach(Partition& part, uint32_t frame);
+
+    uint32_t take_free(Partition& part);
+
+    void put_free(Partition& part, uint32_t frame);
+
+    void set_dirty(uint32_t frame, bool dirty);
+
+    void wake_flusher();
+
+    bool in_flight(diskpos_t pos) const;
+
+    void wait_io(diskpos_t pos);
+
+    uint32_t take_victim(Partition& part);
+
+    uint32_t evict(Partition& part, std::unique_lock<std::mutex>& lock);
+
+    uint32_t load(Partition& part, std::unique_lock<std::mutex>& lock, diskpos_t pos);
+
+    template<typename PageT>
+    Handle<PageT> fetch(diskpos_t pos, bool dirty);
 
-    void evict();
+    size_t write_back(Partition& part);
 
-    void promote(diskpos_t pos);
+    void flusher_loop();
 
-    void load(diskpos_t pos);
+    void write_dirty();
+
+    void commit_pages();
+
+    void checkpoint_frozen();
+
+    void recover();
 
 public:
-    BufferManager(size_t cache_capacity = CACHE_CAPACITY, const std::string& file_name = "default.dat");
+    BufferManager(const std::string& file_name = "default.dat", const BufferOptions& options = BufferOptions());
 
     BufferManager(const BufferManager& oth) = delete;
 
@@ -44,146 +218,1050 @@ public:
 
     BufferManager& operator=(const BufferManager& oth) = delete;
 
-    std::shared_ptr<const PAGE_TYPE> get_page(diskpos_t pos);
+    ConstHandle get_page(diskpos_t pos);
 
-    std::shared_ptr<PAGE_TYPE> get_page_mutable(diskpos_t pos);
+    MutHandle get_page_mutable(diskpos_t pos);
 
     void mark_dirty(diskpos_t pos);
 
+    // Pages the caller keeps pinned for good. The pool grows by as many frames, up to the
+    // reserve, so that they do not come out of the capacity left to the LRU.
+    void set_pinned(size_t pages);
+
     diskpos_t insert_page(PAGE_TYPE& page);
 
+    void insert_page(diskpos_t pos, PAGE_TYPE& page);
+
+    diskpos_t allocate_page();
+
+    void write_page(diskpos_t pos, PAGE_TYPE& page);
+
+    void free_page(diskpos_t pos);
+
+    // Pages freed so far; a caller that remembers a position can tell it may have been reused.
+    size_t freed_pages() const;
+
+    // Reads the pages not yet cached into unpinned frames ahead of their use, without evicting
+    // anything pinned or uncommitted. Consecutive positions are read with one call, after a
+    // hint that lets the kernel fetch the whole batch at once. Not used in concurrent mode.
+    void prefetch(std::vector<diskpos_t> positions);
+
     void flush();
 
+    bool logging() const;
+
+    bool concurrent() const;
+
+    size_t capacity() const;
+
+    size_t partitions() const;
+
+    void log_op(LogType type, const KEYPAIR_TYPE& kp);
+
+    void end_op(diskpos_t root);
+
+    // Commits the uncommitted pages once they fill half the pool, like end_op but without
+    // ending an operation. For work that keeps the tree's contents, such as moving messages.
+    void settle(diskpos_t root);
+
+    void sync(diskpos_t root);
+
+    void checkpoint(diskpos_t root);
+
+    void begin_unlogged();
+
+    void end_unlogged(diskpos_t root);
+
+    std::vector<std::pair<LogType, KEYPAIR_TYPE>> take_redo();
+
     diskpos_t get_root_pos();
 
     void set_root_pos(diskpos_t pos);
 
-    void finish_use(diskpos_t pos);
+    IoBackend io_backend() const;
+
+    size_t reused_pages() const;
+
+    size_t appended_pages() const;
+
+    size_t fetch_count() const;
+
+    size_t cache_hits() const;
+
+    size_t cache_misses() const;
+
+    size_t dirty_pages() const;
+
+    size_t foreground_writes() const;
+
+    size_t background_writes() const;
+
+    BufferStats stats() const;
 
 };
 
+PAGE_HANDLE_TEMPLATE_ARGS
+PAGE_HANDLE_TYPE::Handle(BufferManager* buffer, uint32_t frame, PageT* page) : buffer_(buffer), frame_(frame), page_(page) {}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PAGE_HANDLE_TYPE::Handle(const Handle& oth) : buffer_(oth.buffer_), frame_(oth.frame_), page_(oth.page_) {
+    if (buffer_ != nullptr) {
+        buffer_->retain(frame_);
+    }
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PAGE_HANDLE_TYPE::Handle(Handle&& oth) noexcept : buffer_(oth.buffer_), frame_(oth.frame_), page_(oth.page_), latched_(oth.latched_) {
+    oth.buffer_ = nullptr;
+    oth.page_ = nullptr;
+    oth.latched_ = 0;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PAGE_HANDLE_TYPE::~Handle() {
+    reset();
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+typename PAGE_HANDLE_TYPE& PAGE_HANDLE_TYPE::operator=(Handle oth) noexcept {
+    std::swap(buffer_, oth.buffer_);
+    std::swap(frame_, oth.frame_);
+    std::swap(page_, oth.page_);
+    std::swap(latched_, oth.latched_);
+    return *this;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PageT* PAGE_HANDLE_TYPE::operator->() const {
+    return page_;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PageT& PAGE_HANDLE_TYPE::operator*() const {
+    return *page_;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PageT* PAGE_HANDLE_TYPE::get() const {
+    return page_;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+diskpos_t PAGE_HANDLE_TYPE::pos() const {
+    return buffer_ == nullptr ? -1 : buffer_->frames_[frame_].pos_;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+PAGE_HANDLE_TYPE::operator bool() const {
+    return page_ != nullptr;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+void PAGE_HANDLE_TYPE::latch(bool exclusive) {
+    if (buffer_ == nullptr || !buffer_->concurrent_ || latched_ != 0) {
+        return;
+    }
+    if (exclusive) {
+        buffer_->latches_[frame_].lock();
+    }
+    else {
+        buffer_->latches_[frame_].lock_shared();
+    }
+    latched_ = exclusive ? 2 : 1;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+bool PAGE_HANDLE_TYPE::try_latch(bool exclusive) {
+    if (buffer_ == nullptr || !buffer_->concurrent_ || latched_ != 0) {
+        return true;
+    }
+    bool ok = exclusive ? buffer_->latches_[frame_].try_lock() : buffer_->latches_[frame_].try_lock_shared();
+    if (ok) {
+        latched_ = exclusive ? 2 : 1;
+    }
+    return ok;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+void PAGE_HANDLE_TYPE::unlatch() {
+    if (latched_ == 2) {
+        buffer_->latches_[frame_].unlock();
+    }
+    else if (latched_ == 1) {
+        buffer_->latches_[frame_].unlock_shared();
+    }
+    latched_ = 0;
+}
+
+PAGE_HANDLE_TEMPLATE_ARGS
+void PAGE_HANDLE_TYPE::reset() {
+    if (buffer_ != nullptr) {
+        unlatch();
+        buffer_->release(frame_);
+        buffer_ = nullptr;
+        page_ = nullptr;
+    }
+}
+
 BUFFER_MANAGER_TEMPLATE_ARGS
-BUFFER_MANAGER_TYPE::BufferManager(size_t cache_capacity, const std::string& file_name) : cache_capacity_(cache_capacity) {
-    disk_.initialise(file_name);
+BUFFER_MANAGER_TYPE::BufferManager(const std::string& file_name, const BufferOptions& options) : cache_capacity_(options.cache_capacity_) {
+    disk_.initialise(file_name, options.io_backend_);
+    // Frames for the pages the tree keeps pinned, on top of the capacity; see set_pinned.
+    if (options.pinned_levels_ > 0 && !options.concurrent_) {
+        reserved_ = options.pinned_pages_;
+    }
+    size_t frame_count = cache_capacity_ + reserved_;
+    size_t bytes = (frame_count * sizeof(PAGE_TYPE) + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT * PAGE_ALIGNMENT;
+    pages_ = static_cast<PAGE_TYPE *>(std::aligned_alloc(PAGE_ALIGNMENT, bytes));
+    frames_.resize(frame_count);
+    if (options.concurrent_) {
+        concurrent_ = true;
+        latches_.reset(new Latch[frame_count]);
+        part_count_ = std::max<size_t>(1, std::min(options.partitions_, cache_capacity_));
+    }
+    size_t table_size = 1;
+    while (table_size < frame_count * 2) {
+        table_size <<= 1;
+    }
+    table_mask_ = table_size - 1;
+    parts_.reset(new Partition[part_count_]);
+    for (size_t i = 0; i < part_count_; i++) {
+        parts_[i].table_.resize(table_size);
+        parts_[i].free_frames_.reserve(frame_count);
+    }
+    for (size_t i = frame_count; i > 0; i--) {
+        uint32_t frame = static_cast<uint32_t>(i - 1);
+        frames_[frame].part_ = frame % part_count_;
+        parts_[frame % part_count_].free_frames_.push_back(frame);
+    }
+    if (options.wal_) {
+        logging_ = true;
+        group_commit_ = options.wal_group_commit_;
+        checkpoint_bytes_ = options.wal_checkpoint_bytes_;
+        if (wal_.initialise(file_name + ".wal")) {
+            recover();
+        }
+    }
+    if (options.background_flush_) {
+        dirty_high_ = static_cast<size_t>(cache_capacity_ * options.dirty_ratio_);
+        staging_ = static_cast<PAGE_TYPE *>(std::aligned_alloc(PAGE_ALIGNMENT, FLUSH_BATCH * sizeof(PAGE_TYPE)));
+        inflight_.reserve(FLUSH_BATCH);
+        flusher_ = std::thread(&BufferManager::flusher_loop, this);
+    }
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
 BUFFER_MANAGER_TYPE::~BufferManager() {
+    if (flusher_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(latch_);
+            stop_ = true;
+        }
+        flush_cv_.notify_one();
+        flusher_.join();
+    }
     flush();
+    std::free(staging_);
+    std::free(pages_);
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::evict() {
-    if (lru_list_.empty()) {
+std::unique_lock<std::mutex> BUFFER_MANAGER_TYPE::guard() const {
+    if (concurrent_ || flusher_.joinable()) {
+        return std::unique_lock<std::mutex>(latch_);
+    }
+    return std::unique_lock<std::mutex>();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+std::unique_lock<std::mutex> BUFFER_MANAGER_TYPE::guard(Partition& part) const {
+    if (concurrent_ || flusher_.joinable()) {
+        return std::unique_lock<std::mutex>(part.latch_);
+    }
+    return std::unique_lock<std::mutex>();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+std::vector<std::unique_lock<std::mutex>> BUFFER_MANAGER_TYPE::freeze() const {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (size_t i = 0; i < part_count_; i++) {
+        locks.push_back(guard(parts_[i]));
+    }
+    return locks;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+typename BUFFER_MANAGER_TYPE::Partition& BUFFER_MANAGER_TYPE::part_of(diskpos_t pos) const {
+    if (part_count_ == 1) {
+        return parts_[0];
+    }
+    return parts_[(static_cast<uint64_t>(pos) * 0x9E3779B97F4A7C15ull >> 48) % part_count_];
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::slot_of(diskpos_t pos) const {
+    return (static_cast<uint64_t>(pos) * 0x9E3779B97F4A7C15ull >> 32) & table_mask_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+uint32_t BUFFER_MANAGER_TYPE::lookup(const Partition& part, diskpos_t pos) const {
+    for (size_t i = slot_of(pos); part.table_[i].frame_ != NIL; i = (i + 1) & table_mask_) {
+        if (part.table_[i].pos_ == pos) {
+            return part.table_[i].frame_;
+        }
+    }
+    return NIL;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::table_insert(Partition& part, diskpos_t pos, uint32_t frame) {
+    size_t i = slot_of(pos);
+    while (part.table_[i].frame_ != NIL) {
+        i = (i + 1) & table_mask_;
+    }
+    part.table_[i].pos_ = pos;
+    part.table_[i].frame_ = frame;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::table_erase(Partition& part, diskpos_t pos) {
+    std::vector<Slot>& table = part.table_;
+    size_t i = slot_of(pos);
+    while (table[i].pos_ != pos) {
+        if (table[i].frame_ == NIL) {
+            return;
+        }
+        i = (i + 1) & table_mask_;
+    }
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & table_mask_;
+        if (table[j].frame_ == NIL) {
+            break;
+        }
+        size_t home = slot_of(table[j].pos_);
+        if (((j - home) & table_mask_) >= ((j - i) & table_mask_)) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i] = Slot();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::lru_unlink(Partition& part, uint32_t frame) {
+    Frame& f = frames_[frame];
+    if (f.prev_ != NIL) {
+        frames_[f.prev_].next_ = f.next_;
+    }
+    else {
+        part.lru_head_ = f.next_;
+    }
+    if (f.next_ != NIL) {
+        frames_[f.next_].prev_ = f.prev_;
+    }
+    else {
+        part.lru_tail_ = f.prev_;
+    }
+    f.prev_ = NIL;
+    f.next_ = NIL;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::lru_push_front(Partition& part, uint32_t frame) {
+    Frame& f = frames_[frame];
+    f.prev_ = NIL;
+    f.next_ = part.lru_head_;
+    if (part.lru_head_ != NIL) {
+        frames_[part.lru_head_].prev_ = frame;
+    }
+    else {
+        part.lru_tail_ = frame;
+    }
+    part.lru_head_ = frame;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::pin(Partition& part, uint32_t frame) {
+    if (frames_[frame].pin_count_++ == 0) {
+        lru_unlink(part, frame);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::unpin(Partition& part, uint32_t frame) {
+    Frame& f = frames_[frame];
+    if (--f.pin_count_ == 0) {
+        if (f.pos_ == -1) {
+            put_free(part, frame);
+        }
+        else {
+            lru_push_front(part, frame);
+        }
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::retain(uint32_t frame) {
+    Partition& part = parts_[frames_[frame].part_];
+    auto lock = guard(part);
+    pin(part, frame);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::release(uint32_t frame) {
+    Partition& part = parts_[frames_[frame].part_];
+    auto lock = guard(part);
+    unpin(part, frame);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::detach(Partition& part, uint32_t frame) {
+    Frame& f = frames_[frame];
+    table_erase(part, f.pos_);
+    f.pos_ = -1;
+    f.prefetched_ = false;
+    set_dirty(frame, false);
+    if (f.uncommitted_) {
+        auto lock = guard();
+        f.uncommitted_ = false;
+        uncommitted_count_--;
+    }
+    if (f.pin_count_ == 0) {
+        lru_unlink(part, frame);
+        put_free(part, frame);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+uint32_t BUFFER_MANAGER_TYPE::take_free(Partition& part) {
+    uint32_t frame = part.free_frames_.back();
+    part.free_frames_.pop_back();
+    used_frames_.fetch_add(1, std::memory_order_relaxed);
+    return frame;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::put_free(Partition& part, uint32_t frame) {
+    part.free_frames_.push_back(frame);
+    used_frames_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::set_dirty(uint32_t frame, bool dirty) {
+    Frame& f = frames_[frame];
+    bool log = dirty && logging_ && !f.uncommitted_;
+    if (!log && f.dirty_ == dirty) {
         return;
     }
-    for (auto rit = lru_list_.rbegin(); rit != lru_list_.rend(); rit++) {
-        diskpos_t cand = *rit;
-        if (cache_in_use_.find(cand) == cache_in_use_.end()) {
-            auto it = cache_.find(cand);
-            if (it != cache_.end()) {
-                if (it->second.dirty_) {
-                    disk_.update(*(it->second.page_), cand);
-                }
-                lru_list_.erase(std::next(rit).base());
-                cache_.erase(it);
-                return;
-            }
+    auto lock = guard();
+    if (log) {
+        f.uncommitted_ = true;
+        uncommitted_.push_back(frame);
+        uncommitted_count_++;
+    }
+    if (f.dirty_ == dirty) {
+        return;
+    }
+    f.dirty_ = dirty;
+    if (!dirty) {
+        dirty_count_--;
+        return;
+    }
+    dirty_count_++;
+    if (dirty_count_ > dirty_high_ && !flush_wanted_ && flusher_.joinable()) {
+        flush_wanted_ = true;
+        flush_cv_.notify_one();
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::wake_flusher() {
+    if (!flusher_.joinable()) {
+        return;
+    }
+    auto lock = guard();
+    if (!flush_wanted_) {
+        flush_wanted_ = true;
+        flush_cv_.notify_one();
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+bool BUFFER_MANAGER_TYPE::in_flight(diskpos_t pos) const {
+    return !inflight_.empty() && std::find(inflight_.begin(), inflight_.end(), pos) != inflight_.end();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::wait_io(diskpos_t pos) {
+    auto lock = guard();
+    while (in_flight(pos)) {
+        io_cv_.wait(lock);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+uint32_t BUFFER_MANAGER_TYPE::take_victim(Partition& part) {
+    // Frames past the capacity and the pinned pages stay free while the LRU has a victim.
+    if (!part.free_frames_.empty() && used_frames_.load(std::memory_order_relaxed) < cache_capacity_ + pinned_) {
+        return take_free(part);
+    }
+    uint32_t frame = part.lru_tail_;
+    {
+        auto lock = guard();
+        while (frame != NIL && (frames_[frame].uncommitted_ || in_flight(frames_[frame].pos_))) {
+            frame = frames_[frame].prev_;
         }
     }
+    if (frame == NIL) {
+        return part.free_frames_.empty() ? NIL : take_free(part);
+    }
+    Frame& f = frames_[frame];
+    if (f.dirty_) {
+        disk_.update(pages_[frame], f.pos_);
+        foreground_writes_++;
+        wake_flusher();
+    }
+    lru_unlink(part, frame);
+    table_erase(part, f.pos_);
+    f.pos_ = -1;
+    f.prefetched_ = false;
+    set_dirty(frame, false);
+    part.evictions_++;
+    return frame;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::promote(diskpos_t pos) {
-    auto it = cache_.find(pos);
-    if (it != cache_.end()) {
-        lru_list_.erase(it->second.lru_it_);
-        lru_list_.push_front(pos);
-        it->second.lru_it_ = lru_list_.begin();
+uint32_t BUFFER_MANAGER_TYPE::evict(Partition& part, std::unique_lock<std::mutex>& part_lock) {
+    uint32_t idx = static_cast<uint32_t>(&part - parts_.get());
+    while (true) {
+        uint32_t frame = take_victim(part);
+        if (frame != NIL) {
+            return frame;
+        }
+        bool complete = true;
+        for (size_t i = 1; i < part_count_; i++) {
+            Partition& oth = parts_[(idx + i) % part_count_];
+            std::unique_lock<std::mutex> lock(oth.latch_, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                complete = false;
+                continue;
+            }
+            frame = take_victim(oth);
+            if (frame != NIL) {
+                frames_[frame].part_ = idx;
+                return frame;
+            }
+        }
+        if (!complete) {
+            part_lock.unlock();
+            std::this_thread::yield();
+            part_lock.lock();
+            continue;
+        }
+        auto lock = guard();
+        if (inflight_.empty()) {
+            throw std::runtime_error("BufferManager: every frame is pinned or uncommitted");
+        }
+        io_cv_.wait(lock);
     }
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::load(diskpos_t pos) {
-    auto page_ptr = std::make_shared<PAGE_TYPE>();
-    disk_.read(*page_ptr, pos);
-    CacheEntry entry;
-    entry.pos_ = pos;
-    entry.page_ = page_ptr;
-    entry.dirty_ = false;
-    lru_list_.push_front(pos);
-    entry.lru_it_ = lru_list_.begin();
-    cache_[pos] = entry;
+uint32_t BUFFER_MANAGER_TYPE::load(Partition& part, std::unique_lock<std::mutex>& lock, diskpos_t pos) {
+    wait_io(pos);
+    uint32_t frame = evict(part, lock);
+    uint32_t cached = lookup(part, pos);
+    if (cached != NIL) {
+        put_free(part, frame);
+        pin(part, cached);
+        return cached;
+    }
+    disk_.read(pages_[frame], pos);
+    frames_[frame].pos_ = pos;
+    frames_[frame].pin_count_++;
+    table_insert(part, pos, frame);
+    return frame;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-std::shared_ptr<const PAGE_TYPE> BUFFER_MANAGER_TYPE::get_page(diskpos_t pos) {
-    auto it = cache_.find(pos);
-    if (it != cache_.end()) {
-        promote(pos);
-        return std::const_pointer_cast<const PAGE_TYPE>(it->second.page_);
+template<typename PageT>
+typename BUFFER_MANAGER_TYPE::template Handle<PageT> BUFFER_MANAGER_TYPE::fetch(diskpos_t pos, bool dirty) {
+    Partition& part = part_of(pos);
+    auto lock = guard(part);
+    uint32_t frame = lookup(part, pos);
+    if (frame == NIL) {
+        part.misses_++;
+        frame = load(part, lock, pos);
+    }
+    else {
+        part.hits_++;
+        if (frames_[frame].prefetched_) {
+            frames_[frame].prefetched_ = false;
+            part.prefetch_hits_++;
+        }
+        pin(part, frame);
     }
-    if (cache_.size() >= cache_capacity_) {
-        evict();
+    if (dirty) {
+        set_dirty(frame, true);
     }
-    load(pos);
-    return std::const_pointer_cast<const PAGE_TYPE>(cache_[pos].page_);
+    return Handle<PageT>(this, frame, pages_ + frame);
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-std::shared_ptr<PAGE_TYPE> BUFFER_MANAGER_TYPE::get_page_mutable(diskpos_t pos) {
-    auto it = cache_.find(pos);
-    if (it != cache_.end()) {
-        promote(pos);
-        mark_dirty(pos);
-        cache_in_use_.insert(pos);
-        return it->second.page_;
+size_t BUFFER_MANAGER_TYPE::write_back(Partition& part) {
+    size_t n = 0;
+    diskpos_t pos[FLUSH_BATCH];
+    {
+        auto part_lock = guard(part);
+        for (uint32_t frame = part.lru_tail_; frame != NIL && n < FLUSH_BATCH; frame = frames_[frame].prev_) {
+            if (!frames_[frame].dirty_ || frames_[frame].uncommitted_) {
+                continue;
+            }
+            std::memcpy(static_cast<void *>(staging_ + n), pages_ + frame, sizeof(PAGE_TYPE));
+            pos[n++] = frames_[frame].pos_;
+            set_dirty(frame, false);
+        }
+        if (n == 0) {
+            return 0;
+        }
+        auto lock = guard();
+        inflight_.assign(pos, pos + n);
     }
-    if (cache_.size() >= cache_capacity_) {
-        evict();
+    for (size_t i = 0; i < n; i++) {
+        disk_.update(staging_[i], pos[i]);
     }
-    load(pos);
-    mark_dirty(pos);
-    cache_in_use_.insert(pos);
-    return cache_[pos].page_;
+    {
+        auto lock = guard();
+        inflight_.clear();
+        background_writes_ += n;
+    }
+    io_cv_.notify_all();
+    return n;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::mark_dirty(diskpos_t pos) {
-    auto it = cache_.find(pos);
-    if (it != cache_.end()) {
-        it->second.dirty_ = true;
+void BUFFER_MANAGER_TYPE::flusher_loop() {
+    std::unique_lock<std::mutex> lock(latch_);
+    while (true) {
+        flush_cv_.wait(lock, [this] { return stop_ || flush_wanted_; });
+        if (stop_) {
+            break;
+        }
+        bool more = true;
+        while (more) {
+            lock.unlock();
+            size_t n = 0;
+            for (size_t i = 0; i < part_count_; i++) {
+                n += write_back(parts_[i]);
+            }
+            lock.lock();
+            more = n > 0 && !stop_ && dirty_count_ > dirty_high_ / 2;
+        }
+        flush_wanted_ = false;
     }
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-diskpos_t BUFFER_MANAGER_TYPE::insert_page(Page<KeyType, ValueType> &page) {
-    if (cache_.size() >= cache_capacity_) {
-        evict();
+typename BUFFER_MANAGER_TYPE::ConstHandle BUFFER_MANAGER_TYPE::get_page(diskpos_t pos) {
+    return fetch<const PAGE_TYPE>(pos, false);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+typename BUFFER_MANAGER_TYPE::MutHandle BUFFER_MANAGER_TYPE::get_page_mutable(diskpos_t pos) {
+    return fetch<PAGE_TYPE>(pos, true);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::mark_dirty(diskpos_t pos) {
+    Partition& part = part_of(pos);
+    auto lock = guard(part);
+    uint32_t frame = lookup(part, pos);
+    if (frame != NIL) {
+        set_dirty(frame, true);
     }
-    diskpos_t pos = disk_.write(page);
-    std::shared_ptr<PAGE_TYPE> page_ptr = std::make_shared<PAGE_TYPE>(page);
-    CacheEntry entry;
-    entry.pos_ = pos;
-    entry.page_ = page_ptr;
-    entry.dirty_ = false;
-    lru_list_.push_front(pos);
-    entry.lru_it_ = lru_list_.begin();
-    cache_[pos] = entry;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::set_pinned(size_t pages) {
+    pinned_ = std::min(pages, reserved_);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+diskpos_t BUFFER_MANAGER_TYPE::insert_page(PAGE_TYPE& page) {
+    diskpos_t pos = allocate_page();
+    insert_page(pos, page);
     return pos;
 }
 
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::insert_page(diskpos_t pos, PAGE_TYPE& page) {
+    Partition& part = part_of(pos);
+    auto lock = guard(part);
+    uint32_t frame = evict(part, lock);
+    std::memcpy(static_cast<void *>(pages_ + frame), &page, sizeof(PAGE_TYPE));
+    frames_[frame].pos_ = pos;
+    set_dirty(frame, true);
+    table_insert(part, pos, frame);
+    lru_push_front(part, frame);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+diskpos_t BUFFER_MANAGER_TYPE::allocate_page() {
+    auto lock = guard();
+    return unlogged_ ? disk_.append() : disk_.allocate();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::write_page(diskpos_t pos, PAGE_TYPE& page) {
+    Partition& part = part_of(pos);
+    auto lock = guard(part);
+    wait_io(pos);
+    uint32_t frame = lookup(part, pos);
+    if (frame != NIL) {
+        detach(part, frame);
+    }
+    disk_.update(page, pos);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::free_page(diskpos_t pos) {
+    Partition& part = part_of(pos);
+    auto part_lock = guard(part);
+    wait_io(pos);
+    uint32_t frame = lookup(part, pos);
+    if (frame != NIL) {
+        detach(part, frame);
+    }
+    auto lock = guard();
+    freed_pages_++;
+    if (logging_ && !unlogged_) {
+        pending_frees_.push_back(pos);
+    }
+    else {
+        disk_.free(pos);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::freed_pages() const {
+    auto lock = guard();
+    return freed_pages_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::prefetch(std::vector<diskpos_t> positions) {
+    if (concurrent_) {
+        return;
+    }
+    Partition& part = parts_[0];
+    auto part_lock = guard(part);
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+    {
+        auto lock = guard();
+        positions.erase(std::remove_if(positions.begin(), positions.end(), [&](diskpos_t pos) {
+            return lookup(part, pos) != NIL || in_flight(pos);
+        }), positions.end());
+    }
+    for (size_t i = 0; i < positions.size();) {
+        size_t j = i + 1;
+        while (j < positions.size() && positions[j] == positions[j - 1] + static_cast<diskpos_t>(sizeof(PAGE_TYPE))) {
+            j++;
+        }
+        disk_.advise(positions[i], j - i);
+        i = j;
+    }
+    std::vector<uint32_t> frames;
+    std::vector<PAGE_TYPE*> targets;
+    for (size_t i = 0; i < positions.size();) {
+        frames.clear();
+        targets.clear();
+        size_t j = i;
+        while (j < positions.size() && (j == i || positions[j] == positions[j - 1] + static_cast<diskpos_t>(sizeof(PAGE_TYPE)))) {
+            uint32_t frame = take_victim(part);
+            if (frame == NIL) {
+                break;
+            }
+            frames.push_back(frame);
+            targets.push_back(pages_ + frame);
+            j++;
+        }
+        if (frames.empty()) {
+            return;
+        }
+        disk_.read_run(targets.data(), frames.size(), positions[i]);
+        for (size_t k = 0; k < frames.size(); k++) {
+            Frame& f = frames_[frames[k]];
+            f.pos_ = positions[i + k];
+            f.prefetched_ = true;
+            table_insert(part, f.pos_, frames[k]);
+            lru_push_front(part, frames[k]);
+        }
+        part.prefetched_ += frames.size();
+        i = j;
+    }
+}
+
 BUFFER_MANAGER_TEMPLATE_ARGS
 void BUFFER_MANAGER_TYPE::flush() {
-    for (auto& pair : cache_) {
-        if (pair.second.dirty_) {
-            disk_.update(*(pair.second.page_), pair.first);
-            pair.second.dirty_ = false;
+    auto locks = freeze();
+    if (logging_) {
+        checkpoint_frozen();
+    }
+    else {
+        write_dirty();
+        auto lock = guard();
+        disk_.sync_header();
+    }
+    for (uint32_t frame = 0; frame < frames_.size(); frame++) {
+        if (frames_[frame].pos_ != -1 && frames_[frame].pin_count_ == 0) {
+            detach(parts_[frames_[frame].part_], frame);
+        }
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::write_dirty() {
+    {
+        auto lock = guard();
+        while (!inflight_.empty()) {
+            io_cv_.wait(lock);
+        }
+    }
+    for (uint32_t frame = 0; frame < frames_.size(); frame++) {
+        Frame& f = frames_[frame];
+        if (f.pos_ != -1 && f.dirty_) {
+            disk_.update(pages_[frame], f.pos_);
+            set_dirty(frame, false);
+            checkpoint_writes_++;
+        }
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::commit_pages() {
+    auto lock = guard();
+    for (uint32_t frame : uncommitted_) {
+        Frame& f = frames_[frame];
+        if (f.uncommitted_) {
+            wal_.append_page(f.pos_, pages_[frame]);
+            f.uncommitted_ = false;
+        }
+    }
+    uncommitted_.clear();
+    uncommitted_count_ = 0;
+    PAGE_TYPE link;
+    std::vector<diskpos_t> links;
+    for (diskpos_t pos : pending_frees_) {
+        diskpos_t next = disk_.push_free(pos);
+        std::memset(static_cast<void *>(&link), 0, sizeof(PAGE_TYPE));
+        std::memcpy(static_cast<void *>(&link), &next, sizeof(diskpos_t));
+        wal_.append_page(pos, link);
+        links.push_back(next);
+    }
+    wal_.append(LogType::Commit, disk_.header_data(), disk_.header_length());
+    wal_.sync();
+    ops_since_sync_ = 0;
+    for (size_t i = 0; i < pending_frees_.size(); i++) {
+        std::memset(static_cast<void *>(&link), 0, sizeof(PAGE_TYPE));
+        std::memcpy(static_cast<void *>(&link), &links[i], sizeof(diskpos_t));
+        disk_.update(link, pending_frees_[i]);
+    }
+    pending_frees_.clear();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::checkpoint_frozen() {
+    commit_pages();
+    write_dirty();
+    auto lock = guard();
+    disk_.sync();
+    wal_.truncate(0);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::recover() {
+    // A record whose length does not match its type ends the valid log, like a bad checksum
+    auto well_formed = [this](LogType type, size_t len) {
+        switch (type) {
+            case LogType::Page:
+                return len == sizeof(diskpos_t) + sizeof(PAGE_TYPE);
+            case LogType::Insert:
+            case LogType::Erase:
+                return len == sizeof(KEYPAIR_TYPE);
+            case LogType::Commit:
+                return len == static_cast<size_t>(disk_.header_length());
+        }
+        return false;
+    };
+    diskpos_t commit_end = 0;
+    diskpos_t valid_end = 0;
+    bool stopped = false;
+    wal_.scan([&](LogType type, const char*, size_t len, diskpos_t pos) {
+        if (stopped || !well_formed(type, len)) {
+            stopped = true;
+            return;
+        }
+        valid_end = pos + sizeof(LogRecordHeader) + len;
+        if (type == LogType::Commit) {
+            commit_end = valid_end;
+        }
+    });
+    diskpos_t group_start = valid_end;
+    PAGE_TYPE page;
+    wal_.scan([&](LogType type, const char* data, size_t, diskpos_t pos) {
+        if (pos >= valid_end) {
+            return;
+        }
+        if (pos < commit_end) {
+            if (type == LogType::Page) {
+                diskpos_t page_pos;
+                std::memcpy(&page_pos, data, sizeof(diskpos_t));
+                std::memcpy(static_cast<void *>(&page), data + sizeof(diskpos_t), sizeof(PAGE_TYPE));
+                disk_.update(page, page_pos);
+                disk_.grow(page_pos + sizeof(PAGE_TYPE));
+            }
+            else if (type == LogType::Commit) {
+                disk_.restore_header(data);
+            }
+            return;
+        }
+        if (type == LogType::Page) {
+            group_start = std::min(group_start, pos);
+        }
+        else if (pos < group_start && (type == LogType::Insert || type == LogType::Erase)) {
+            KEYPAIR_TYPE kp;
+            std::memcpy(static_cast<void *>(&kp), data, sizeof(KEYPAIR_TYPE));
+            redo_.push_back({type, kp});
+        }
+    });
+    wal_.truncate(group_start);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+bool BUFFER_MANAGER_TYPE::logging() const {
+    return logging_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+bool BUFFER_MANAGER_TYPE::concurrent() const {
+    return concurrent_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::capacity() const {
+    return cache_capacity_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::partitions() const {
+    return part_count_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::log_op(LogType type, const KEYPAIR_TYPE& kp) {
+    if (logging_) {
+        wal_.append(type, &kp, sizeof(KEYPAIR_TYPE));
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::end_op(diskpos_t root) {
+    if (!logging_) {
+        return;
+    }
+    bool commit;
+    {
+        auto lock = guard();
+        disk_.write_info(root, 2);
+        commit = uncommitted_count_ * 2 >= cache_capacity_;
+    }
+    if (commit) {
+        auto locks = freeze();
+        commit_pages();
+    }
+    else if (++ops_since_sync_ >= group_commit_) {
+        wal_.sync();
+        ops_since_sync_ = 0;
+    }
+    if (static_cast<size_t>(wal_.size()) >= checkpoint_bytes_) {
+        auto locks = freeze();
+        checkpoint_frozen();
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::settle(diskpos_t root) {
+    if (!logging_) {
+        return;
+    }
+    bool commit;
+    {
+        auto lock = guard();
+        commit = uncommitted_count_ * 2 >= cache_capacity_;
+        if (commit) {
+            disk_.write_info(root, 2);
         }
     }
-    cache_.clear();
-    lru_list_.clear();
-    cache_in_use_.clear();
+    if (commit) {
+        auto locks = freeze();
+        commit_pages();
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::sync(diskpos_t root) {
+    if (logging_) {
+        wal_.sync();
+        ops_since_sync_ = 0;
+        return;
+    }
+    checkpoint(root);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::checkpoint(diskpos_t root) {
+    auto locks = freeze();
+    {
+        auto lock = guard();
+        disk_.write_info(root, 2);
+    }
+    if (logging_) {
+        checkpoint_frozen();
+        return;
+    }
+    write_dirty();
+    auto lock = guard();
+    disk_.sync();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::begin_unlogged() {
+    if (!logging_) {
+        return;
+    }
+    auto locks = freeze();
+    checkpoint_frozen();
+    auto lock = guard();
+    unlogged_ = true;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::end_unlogged(diskpos_t root) {
+    if (!logging_) {
+        return;
+    }
+    {
+        auto lock = guard();
+        unlogged_ = false;
+    }
+    checkpoint(root);
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+std::vector<std::pair<LogType, KEYPAIR_TYPE>> BUFFER_MANAGER_TYPE::take_redo() {
+    return std::move(redo_);
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
@@ -199,10 +1277,86 @@ void BUFFER_MANAGER_TYPE::set_root_pos(diskpos_t pos) {
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::finish_use(diskpos_t pos) {
-    cache_in_use_.erase(pos);
+IoBackend BUFFER_MANAGER_TYPE::io_backend() const {
+    return disk_.backend();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::reused_pages() const {
+    auto lock = guard();
+    return disk_.reused_count();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::appended_pages() const {
+    auto lock = guard();
+    return disk_.appended_count();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::fetch_count() const {
+    return cache_hits() + cache_misses();
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::cache_hits() const {
+    size_t hits = 0;
+    for (size_t i = 0; i < part_count_; i++) {
+        auto lock = guard(parts_[i]);
+        hits += parts_[i].hits_;
+    }
+    return hits;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::cache_misses() const {
+    size_t misses = 0;
+    for (size_t i = 0; i < part_count_; i++) {
+        auto lock = guard(parts_[i]);
+        misses += parts_[i].misses_;
+    }
+    return misses;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::dirty_pages() const {
+    auto lock = guard();
+    return dirty_count_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::foreground_writes() const {
+    return foreground_writes_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::background_writes() const {
+    auto lock = guard();
+    return background_writes_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+BufferStats BUFFER_MANAGER_TYPE::stats() const {
+    BufferStats stats;
+    stats.capacity_ = cache_capacity_;
+    for (size_t i = 0; i < part_count_; i++) {
+        auto lock = guard(parts_[i]);
+        stats.hits_ += parts_[i].hits_;
+        stats.misses_ += parts_[i].misses_;
+        stats.evictions_ += parts_[i].evictions_;
+        stats.prefetched_ += parts_[i].prefetched_;
+        stats.prefetch_hits_ += parts_[i].prefetch_hits_;
+    }
+    stats.foreground_writes_ = foreground_writes_;
+    stats.bytes_read_ = disk_.bytes_read();
+    stats.bytes_written_ = disk_.bytes_written();
+    auto lock = guard();
+    stats.dirty_pages_ = dirty_count_;
+    stats.background_writes_ = background_writes_;
+    stats.checkpoint_writes_ = checkpoint_writes_;
+    return stats;
 }
 
 } // namespace sjtu
 
-#endif // BUFFER_HPP
\ No newline at end of file
+#endif // BUFFER_HPP
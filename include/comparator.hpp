@@ -3,6 +3,7 @@
 
 #include <type_traits>
 #include <cstddef>
+#include <cstring>
 
 #include "config.hpp"
 #include "type_helper.hpp"
@@ -57,16 +58,45 @@ public:
     int operator()(const FixedType& a, const FixedType& b) const;
 };
 
+// The order is chosen at compile time: operator< when the type has one, the object bytes
+// (memcmp) for types whose bytes are their value, and the hash pair for types that are not
+// trivially copyable. Trivially copyable types with padding must provide operator<: their
+// padding bytes are arbitrary, so neither memcmp nor the byte hash agrees with equality.
 COMPARATOR_TEMPLATE_ARGS
 int COMPARATOR_TYPE::operator()(const FixedType &a, const FixedType &b) const {
-    MEMORYHASH_TYPE hash_a(a), hash_b(b);
-    if (hash_a.hash1() == hash_b.hash1()) {
-        if (hash_a.hash2() == hash_b.hash2()) {
-            return 0;
+    static_assert(has_operator_less_v<FixedType> || std::has_unique_object_representations_v<FixedType>
+                  || !std::is_trivially_copyable_v<FixedType>, "Key types with padding bytes need operator<!");
+    if constexpr (has_operator_less_v<FixedType>) {
+        if (a < b) {
+            return -1;
         }
-        return (hash_a.hash2() > hash_b.hash2()) ? 1 : -1;
+        return (b < a) ? 1 : 0;
+    }
+    else if constexpr (std::has_unique_object_representations_v<FixedType>) {
+        int c = std::memcmp(&a, &b, sizeof(FixedType));
+        return (c > 0) - (c < 0);
+    }
+    else {
+        MEMORYHASH_TYPE hash_a(a), hash_b(b);
+        if (hash_a.hash1() == hash_b.hash1()) {
+            if (hash_a.hash2() == hash_b.hash2()) {
+                return 0;
+            }
+            return (hash_a.hash2() > hash_b.hash2()) ? 1 : -1;
+        }
+        return (hash_a.hash1() > hash_b.hash1()) ? 1 : -1;
+    }
+}
+
+// a < b in Comparator's order; calls operator< directly when the type has one.
+template<typename FixedType>
+bool ordered_less(const FixedType& a, const FixedType& b) {
+    if constexpr (has_operator_less_v<FixedType>) {
+        return a < b;
+    }
+    else {
+        return COMPARATOR_TYPE()(a, b) < 0;
     }
-    return (hash_a.hash1() > hash_b.hash1()) ? 1 : -1;
 }
 
 } // namespace sjtu
@@ -8,11 +8,76 @@ namespace sjtu {
 
 typedef int64_t diskpos_t;
 
-constexpr size_t PAGE_SLOT_COUNT = 200;
-static_assert(PAGE_SLOT_COUNT % 2 == 0, "Slot count must be even!");
+constexpr size_t PAGE_SIZE = 16384;
+
+constexpr size_t PAGE_ALIGNMENT = 4096;
+
+constexpr size_t PAGE_FRAME_SIZE = (PAGE_SIZE + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT * PAGE_ALIGNMENT;
+
+enum class IoBackend {
+    Stream,
+    Posix,
+    Direct
+};
+
+constexpr IoBackend IO_BACKEND = IoBackend::Stream;
 
 constexpr size_t CACHE_CAPACITY = 500;
 
+constexpr size_t BUFFER_PARTITIONS = 8;
+
+constexpr double FLUSH_DIRTY_RATIO = 0.25;
+
+constexpr size_t FLUSH_BATCH = 16;
+
+constexpr size_t WAL_GROUP_COMMIT = 64;
+
+constexpr size_t WAL_CHECKPOINT_BYTES = 64 << 20;
+
+constexpr size_t BLOOM_BITS_PER_KEY = 10;
+
+constexpr size_t BLOOM_MIN_KEYS = 1024;
+
+// Children per internal page in message-buffer mode; the remaining slots hold messages.
+constexpr size_t MESSAGE_FANOUT = 16;
+
+// Levels the driver and benchmark pin when asked to, root included.
+constexpr size_t PINNED_LEVELS = 2;
+
+// Upper bound on the pages the pinned top levels may hold; a level that does not fit stays in the LRU.
+constexpr size_t PINNED_PAGES = 256;
+
+// Leaf readahead: the window opens after READAHEAD_TRIGGER steps to the right in a row, starts
+// at READAHEAD_MIN pages and doubles up to readahead_pages_, at most a quarter of the pool.
+constexpr size_t READAHEAD_TRIGGER = 2;
+
+constexpr size_t READAHEAD_MIN = 4;
+
+constexpr size_t READAHEAD_PAGES = 32;
+
+struct BufferOptions {
+    size_t cache_capacity_ = CACHE_CAPACITY;
+    IoBackend io_backend_ = IO_BACKEND;
+    bool background_flush_ = false;
+    double dirty_ratio_ = FLUSH_DIRTY_RATIO;
+    bool wal_ = false;
+    size_t wal_group_commit_ = WAL_GROUP_COMMIT;
+    size_t wal_checkpoint_bytes_ = WAL_CHECKPOINT_BYTES;
+    bool concurrent_ = false;
+    size_t partitions_ = BUFFER_PARTITIONS;
+    bool latency_histograms_ = false;
+    bool bloom_filter_ = false;
+    size_t bloom_bits_per_key_ = BLOOM_BITS_PER_KEY;
+    bool message_buffers_ = false;
+    size_t message_fanout_ = MESSAGE_FANOUT;
+    size_t pinned_levels_ = 0;
+    size_t pinned_pages_ = PINNED_PAGES;
+    bool readahead_ = false;
+    size_t readahead_pages_ = READAHEAD_PAGES;
+};
+
+constexpr double BULK_LOAD_FILL_FACTOR = 1.0;
+
 typedef int64_t hash_t;
 
 constexpr hash_t HASH_MOD1 = 998244353;
@@ -1,8 +1,19 @@
 #ifndef DISK_HPP
 #define DISK_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <fstream>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "config.hpp"
 #include "type_helper.hpp"
@@ -14,75 +25,265 @@ namespace sjtu {
 template<typename FixedType, typename FixedInfoType = diskpos_t, int info_len = 4>
 class DiskManager {
 private:
+    IoBackend backend_ = IoBackend::Stream;
     std::fstream file_;
+    std::mutex stream_mutex_;
+    int fd_ = -1;
     std::string file_name_;
     constexpr static diskpos_t sizeofT = sizeof(FixedType);
     constexpr static diskpos_t sizeofInfo = sizeof(FixedInfoType);
     constexpr static diskpos_t info_offset = info_len * sizeofInfo;
-    
+    constexpr static diskpos_t header_size = (info_offset + sizeof(diskpos_t) + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT * PAGE_ALIGNMENT;
+    char* header_ = nullptr;
+    char* scratch_ = nullptr;
+    bool header_dirty_ = false;
+    diskpos_t file_end_ = 0;
+    size_t reused_count_ = 0;
+    size_t appended_count_ = 0;
+    std::atomic<size_t> bytes_read_{0};
+    std::atomic<size_t> bytes_written_{0};
+
     bool open_file();
 
+    void close_file();
+
+    diskpos_t file_size();
+
+    void read_bytes(void* buf, size_t n, diskpos_t pos);
+
+    void write_bytes(const void* buf, size_t n, diskpos_t pos);
+
+    diskpos_t link_size() const;
+
+    diskpos_t free_head() const;
+
+    void set_free_head(diskpos_t pos);
+
 public:
     DiskManager() = default;
 
+    DiskManager(const DiskManager& oth) = delete;
+
     ~DiskManager();
 
-    bool initialise(const std::string& file_name = "default.dat");
+    DiskManager& operator=(const DiskManager& oth) = delete;
+
+    bool initialise(const std::string& file_name = "default.dat", IoBackend backend = IoBackend::Stream);
+
+    IoBackend backend() const;
 
     void get_info(FixedInfoType& info, int idx);
 
     void write_info(FixedInfoType& info, int idx);
 
+    void sync_header();
+
+    void sync();
+
+    const char* header_data() const;
+
+    diskpos_t header_length() const;
+
+    void restore_header(const char* data);
+
     void read(FixedType& t, const diskpos_t pos);
 
+    // Reads n consecutive objects starting at pos into separate buffers, with one preadv
+    // where the backend has a descriptor.
+    void read_run(FixedType* const* ts, size_t n, const diskpos_t pos);
+
+    // Asks the kernel to start reading n objects at pos in the background. Only the Posix
+    // backend goes through the page cache this way; elsewhere it does nothing.
+    void advise(const diskpos_t pos, size_t n);
+
     void update(FixedType& t, const diskpos_t pos);
 
+    diskpos_t allocate();
+
+    diskpos_t append();
+
+    void grow(diskpos_t end);
+
     diskpos_t write(FixedType& t);
+
+    void free(const diskpos_t pos);
+
+    diskpos_t push_free(const diskpos_t pos);
+
+    size_t reused_count() const;
+
+    size_t appended_count() const;
+
+    size_t bytes_read() const;
+
+    size_t bytes_written() const;
 };
 
 DISKMANAGER_TEMPLATE_ARGS
 bool DISKMANAGER_TYPE::open_file() {
-    file_.open(file_name_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file_) {
-        file_.open(file_name_, std::ios::out | std::ios::binary);
-        file_.close();
+    if (backend_ == IoBackend::Stream) {
         file_.open(file_name_, std::ios::in | std::ios::out | std::ios::binary);
-        int temp = 0;
-        for (int i = 0; i < info_len; i++) {
-            file_.write(reinterpret_cast<char *>(&temp), sizeof(int));
+        if (!file_) {
+            file_.open(file_name_, std::ios::out | std::ios::binary);
+            file_.close();
+            file_.open(file_name_, std::ios::in | std::ios::out | std::ios::binary);
+        }
+    }
+    else {
+        int flags = O_RDWR | O_CREAT;
+        if (backend_ == IoBackend::Direct) {
+            fd_ = (sizeofT % PAGE_ALIGNMENT == 0) ? ::open(file_name_.c_str(), flags | O_DIRECT, 0644) : -1;
+            if (fd_ == -1) {
+                backend_ = IoBackend::Posix;
+            }
+        }
+        if (fd_ == -1) {
+            fd_ = ::open(file_name_.c_str(), flags, 0644);
         }
+    }
+    if (file_size() < header_size) {
+        std::memset(header_, 0, header_size);
+        write_bytes(header_, header_size, 0);
         return false;
     }
+    read_bytes(header_, header_size, 0);
     return true;
 }
 
 DISKMANAGER_TEMPLATE_ARGS
-DISKMANAGER_TYPE::~DiskManager() {
+void DISKMANAGER_TYPE::close_file() {
     if (file_.is_open()) {
         file_.close();
     }
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::file_size() {
+    if (backend_ == IoBackend::Stream) {
+        file_.seekg(0, std::ios::end);
+        return file_.tellg();
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::read_bytes(void* buf, size_t n, diskpos_t pos) {
+    char* dst = static_cast<char *>(buf);
+    size_t done = 0;
+    if (backend_ == IoBackend::Stream) {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        file_.seekg(pos);
+        file_.read(dst, n);
+        done = file_.gcount();
+        file_.clear();
+    }
+    else {
+        while (done < n) {
+            ssize_t r = ::pread(fd_, dst + done, n - done, pos + done);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                break;
+            }
+            done += r;
+        }
+    }
+    bytes_read_.fetch_add(done, std::memory_order_relaxed);
+    if (done < n) {
+        std::memset(dst + done, 0, n - done);
+    }
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::write_bytes(const void* buf, size_t n, diskpos_t pos) {
+    const char* src = static_cast<const char *>(buf);
+    if (backend_ == IoBackend::Stream) {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        file_.seekp(pos);
+        file_.write(src, n);
+        bytes_written_.fetch_add(n, std::memory_order_relaxed);
+        return;
+    }
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = ::pwrite(fd_, src + done, n - done, pos + done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        done += r;
+    }
+    bytes_written_.fetch_add(done, std::memory_order_relaxed);
 }
 
 DISKMANAGER_TEMPLATE_ARGS
-bool DISKMANAGER_TYPE::initialise(const std::string& file_name) {
+diskpos_t DISKMANAGER_TYPE::link_size() const {
+    return (backend_ == IoBackend::Direct) ? PAGE_ALIGNMENT : sizeof(diskpos_t);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::free_head() const {
+    diskpos_t pos;
+    std::memcpy(&pos, header_ + info_offset, sizeof(diskpos_t));
+    return pos;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::set_free_head(diskpos_t pos) {
+    std::memcpy(header_ + info_offset, &pos, sizeof(diskpos_t));
+    header_dirty_ = true;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+DISKMANAGER_TYPE::~DiskManager() {
+    if (header_ != nullptr) {
+        sync_header();
+    }
+    close_file();
+    std::free(header_);
+    std::free(scratch_);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+bool DISKMANAGER_TYPE::initialise(const std::string& file_name, IoBackend backend) {
     file_name_ = file_name;
+    backend_ = backend;
+    if (header_ == nullptr) {
+        header_ = static_cast<char *>(std::aligned_alloc(PAGE_ALIGNMENT, header_size));
+        scratch_ = static_cast<char *>(std::aligned_alloc(PAGE_ALIGNMENT, PAGE_ALIGNMENT));
+    }
     bool f = open_file();
+    header_dirty_ = false;
+    diskpos_t size = file_size();
+    file_end_ = header_size;
+    if (size > header_size) {
+        file_end_ += (size - header_size + sizeofT - 1) / sizeofT * sizeofT;
+    }
     return f;
 }
 
+DISKMANAGER_TEMPLATE_ARGS
+IoBackend DISKMANAGER_TYPE::backend() const {
+    return backend_;
+}
+
 DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::get_info(FixedInfoType &info, int idx) {
     if (idx < 1 || idx > info_len) {
         return;
     }
-    if (!file_.is_open()) {
-        open_file();
-    }
-    if (!file_) {
-        return;
-    }
-    file_.seekg((idx - 1) * sizeofInfo);
-    file_.read(reinterpret_cast<char *>(&info), sizeofInfo);
+    std::memcpy(&info, header_ + (idx - 1) * sizeofInfo, sizeofInfo);
 }
 
 DISKMANAGER_TEMPLATE_ARGS
@@ -90,36 +291,163 @@ void DISKMANAGER_TYPE::write_info(FixedInfoType& info, int idx) {
     if (idx < 1 || idx > info_len) {
         return;
     }
-    if (!file_.is_open()) {
-        open_file();
+    std::memcpy(header_ + (idx - 1) * sizeofInfo, &info, sizeofInfo);
+    header_dirty_ = true;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::sync_header() {
+    if (header_dirty_) {
+        write_bytes(header_, header_size, 0);
+        header_dirty_ = false;
     }
-    if (!file_) {
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::sync() {
+    sync_header();
+    if (backend_ != IoBackend::Stream) {
+        ::fdatasync(fd_);
         return;
     }
-    file_.seekp((idx - 1) * sizeofInfo);
-    file_.write(reinterpret_cast<char *>(&info), sizeofInfo);
+    file_.flush();
+    int fd = ::open(file_name_.c_str(), O_RDONLY);
+    if (fd != -1) {
+        ::fdatasync(fd);
+        ::close(fd);
+    }
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+const char* DISKMANAGER_TYPE::header_data() const {
+    return header_;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::header_length() const {
+    return header_size;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::restore_header(const char* data) {
+    std::memcpy(header_, data, header_size);
+    header_dirty_ = true;
 }
 
 DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::read(FixedType& t, const diskpos_t pos) {
-    file_.seekg(pos);
-    file_.read(reinterpret_cast<char *>(&t), sizeofT);
+    read_bytes(&t, sizeofT, pos);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::read_run(FixedType* const* ts, size_t n, const diskpos_t pos) {
+    size_t done = 0;
+    if (backend_ != IoBackend::Stream && n > 1) {
+        constexpr size_t MAX_IOV = 64;
+        struct iovec iov[MAX_IOV];
+        size_t count = std::min(n, MAX_IOV);
+        for (size_t i = 0; i < count; i++) {
+            iov[i].iov_base = ts[i];
+            iov[i].iov_len = sizeofT;
+        }
+        ssize_t r;
+        do {
+            r = ::preadv(fd_, iov, static_cast<int>(count), pos);
+        } while (r < 0 && errno == EINTR);
+        if (r > 0) {
+            bytes_read_.fetch_add(r, std::memory_order_relaxed);
+            done = static_cast<size_t>(r) / sizeofT;
+        }
+    }
+    // Whatever one call did not fill, including a torn last object, goes one object at a time.
+    for (size_t i = done; i < n; i++) {
+        read(*ts[i], pos + static_cast<diskpos_t>(i) * sizeofT);
+    }
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::advise(const diskpos_t pos, size_t n) {
+    if (backend_ == IoBackend::Posix) {
+        ::posix_fadvise(fd_, pos, static_cast<off_t>(n * sizeofT), POSIX_FADV_WILLNEED);
+    }
 }
 
 DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::update(FixedType &t, const diskpos_t pos) {
-    file_.seekp(pos);
-    file_.write(reinterpret_cast<char *>(&t), sizeofT);
+    write_bytes(&t, sizeofT, pos);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::allocate() {
+    diskpos_t pos = free_head();
+    if (pos != 0) {
+        read_bytes(scratch_, link_size(), pos);
+        diskpos_t next;
+        std::memcpy(&next, scratch_, sizeof(diskpos_t));
+        set_free_head(next);
+        reused_count_++;
+        return pos;
+    }
+    return append();
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::append() {
+    diskpos_t pos = file_end_;
+    file_end_ += sizeofT;
+    appended_count_++;
+    return pos;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::grow(diskpos_t end) {
+    if (end > file_end_) {
+        file_end_ = end;
+    }
 }
 
 DISKMANAGER_TEMPLATE_ARGS
 diskpos_t DISKMANAGER_TYPE::write(FixedType& t) {
-    file_.seekp(0, std::ios::end);
-    diskpos_t pos = file_.tellp();
-    file_.write(reinterpret_cast<char *>(&t), sizeofT);
+    diskpos_t pos = allocate();
+    update(t, pos);
     return pos;
 }
 
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::free(const diskpos_t pos) {
+    std::memset(scratch_, 0, link_size());
+    diskpos_t next = push_free(pos);
+    std::memcpy(scratch_, &next, sizeof(diskpos_t));
+    write_bytes(scratch_, link_size(), pos);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+diskpos_t DISKMANAGER_TYPE::push_free(const diskpos_t pos) {
+    diskpos_t next = free_head();
+    set_free_head(pos);
+    return next;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::reused_count() const {
+    return reused_count_;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::appended_count() const {
+    return appended_count_;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::bytes_read() const {
+    return bytes_read_.load(std::memory_order_relaxed);
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::bytes_written() const {
+    return bytes_written_.load(std::memory_order_relaxed);
+}
+
 } // namespace sjtu
 
-#endif // DISK_HPP
\ No newline at end of file
+#endif // DISK_HPP
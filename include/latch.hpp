@@ -0,0 +1,79 @@
+#ifndef LATCH_HPP
+#define LATCH_HPP
+
+#include <pthread.h>
+
+namespace sjtu {
+
+// Reader-writer latch for page frames and the tree-wide locks in concurrent mode. Unlike
+// std::shared_mutex on glibc, a writer that is waiting blocks readers that arrive after it,
+// so threads that keep scanning cannot starve inserts. In exchange a thread must never take
+// the same latch twice, not even shared. Meets the SharedMutex requirements, so
+// std::unique_lock and std::shared_lock work with it.
+class Latch {
+private:
+    pthread_rwlock_t lock_;
+
+public:
+    Latch();
+
+    Latch(const Latch& oth) = delete;
+
+    ~Latch();
+
+    Latch& operator=(const Latch& oth) = delete;
+
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+    void lock_shared();
+
+    bool try_lock_shared();
+
+    void unlock_shared();
+};
+
+inline Latch::Latch() {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#if defined(__GLIBC__)
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&lock_, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+inline Latch::~Latch() {
+    pthread_rwlock_destroy(&lock_);
+}
+
+inline void Latch::lock() {
+    pthread_rwlock_wrlock(&lock_);
+}
+
+inline bool Latch::try_lock() {
+    return pthread_rwlock_trywrlock(&lock_) == 0;
+}
+
+inline void Latch::unlock() {
+    pthread_rwlock_unlock(&lock_);
+}
+
+inline void Latch::lock_shared() {
+    pthread_rwlock_rdlock(&lock_);
+}
+
+inline bool Latch::try_lock_shared() {
+    return pthread_rwlock_tryrdlock(&lock_) == 0;
+}
+
+inline void Latch::unlock_shared() {
+    pthread_rwlock_unlock(&lock_);
+}
+
+} // namespace sjtu
+
+#endif // LATCH_HPP
@@ -1,14 +1,36 @@
 #ifndef PAGE_HPP
 #define PAGE_HPP
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "config.hpp"
 #include "comparator.hpp"
 #include "type_helper.hpp"
+#include "search.hpp"
 
 namespace sjtu {
 #define KEYPAIR_TYPE KeyPair<KeyType, ValueType>
 #define KEYPAIR_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
 
+#define LEAF_PAGE_TYPE LeafPage<KeyType, ValueType>
+#define LEAF_PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
+
+#define FIXED_LEAF_PAGE_TYPE FixedLeafPage<KeyType, ValueType>
+#define PACKED_LEAF_PAGE_TYPE PackedLeafPage<KeyType, ValueType>
+#define COLUMN_LEAF_PAGE_TYPE ColumnLeafPage<KeyType, ValueType>
+
+#define LEAF_RUN_TYPE LeafRun<KeyType, ValueType>
+#define LEAF_RUN_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
+
+#define INTERNAL_PAGE_TYPE InternalPage<KeyType, ValueType>
+#define INTERNAL_PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
+
 #define PAGE_TYPE Page<KeyType, ValueType>
 #define PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
 
@@ -93,38 +115,131 @@ enum class PageType {
     Internal
 };
 
-PAGE_TEMPLATE_ARGS
-struct Page {
-    KEYPAIR_TYPE data_[PAGE_SLOT_COUNT + 2];
-    diskpos_t ch_[PAGE_SLOT_COUNT + 2];
-    PageType type_ = PageType::Invalid;
-    diskpos_t fa_ = -1;
-    diskpos_t left_ = -1;
-    diskpos_t right_ = -1;
-    size_t size_ = 0;
-
-    Page() = default;
+// A pending write held in an internal page's message buffer.
+enum class MessageOp : diskpos_t {
+    Insert = 0,
+    Erase
+};
 
-    Page(const Page&) = default;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const KEYPAIR_TYPE* data, size_t size, const KEYPAIR_TYPE& kp) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (data[mid] < kp) {
+            l = mid + 1;
+        }
+        else {
+            ans = mid;
+            r = mid - 1;
+        }
+    }
+    return ans;
+}
 
-    ~Page() = default;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (ordered_less(data[mid].key_, key)) {
+            l = mid + 1;
+        }
+        else {
+            ans = mid;
+            r = mid - 1;
+        }
+    }
+    return ans;
+}
 
-    int lower_bound(const KEYPAIR_TYPE& kp) const;
+KEYPAIR_TEMPLATE_ARGS
+int upper_bound(const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (ordered_less(key, data[mid].key_)) {
+            ans = mid;
+            r = mid - 1;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return ans;
+}
 
-    int lower_bound(const KeyType& key) const;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const uint16_t* slots, const KEYPAIR_TYPE* data, size_t size, const KEYPAIR_TYPE& kp) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (data[slots[mid]] < kp) {
+            l = mid + 1;
+        }
+        else {
+            ans = mid;
+            r = mid - 1;
+        }
+    }
+    return ans;
+}
 
-    KEYPAIR_TYPE front() const;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const uint16_t* slots, const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (ordered_less(data[slots[mid]].key_, key)) {
+            l = mid + 1;
+        }
+        else {
+            ans = mid;
+            r = mid - 1;
+        }
+    }
+    return ans;
+}
 
-    KEYPAIR_TYPE back() const;
+KEYPAIR_TEMPLATE_ARGS
+int upper_bound(const uint16_t* slots, const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (ordered_less(key, data[slots[mid]].key_)) {
+            ans = mid;
+            r = mid - 1;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return ans;
+}
 
-};
+// Eight key bytes from skip on as a big-endian integer, zero-padded. For keys that agree on
+// their first skip bytes, two prefixes compare like the key bytes they come from; equal
+// prefixes decide nothing.
+template<typename KeyType>
+uint64_t normalized_prefix(const KeyType& key, size_t skip = 0) {
+    unsigned char buf[sizeof(uint64_t)] = {};
+    size_t len = key.key_size();
+    if (skip < len) {
+        std::memcpy(buf, key.key_data() + skip, std::min(len - skip, sizeof(uint64_t)));
+    }
+    uint64_t x = 0;
+    for (unsigned char c : buf) {
+        x = (x << 8) | c;
+    }
+    return x;
+}
 
-PAGE_TEMPLATE_ARGS
-int PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
-    int l = 0, r = size_ - 1, mid = -1, ans = r;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const uint64_t* norm, uint64_t p, const KEYPAIR_TYPE* data, size_t size, const KEYPAIR_TYPE& kp) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
     while (l <= r) {
         mid = (l + r) / 2;
-        if (data_[mid] < kp) {
+        if (norm[mid] < p || (norm[mid] == p && data[mid] < kp)) {
             l = mid + 1;
         }
         else {
@@ -135,12 +250,12 @@ int PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
     return ans;
 }
 
-PAGE_TEMPLATE_ARGS
-int PAGE_TYPE::lower_bound(const KeyType& key) const {
-    int l = 0, r = size_ - 1, mid = -1, ans = r;
+KEYPAIR_TEMPLATE_ARGS
+int lower_bound(const uint64_t* norm, uint64_t p, const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
     while (l <= r) {
         mid = (l + r) / 2;
-        if (data_[mid].key_ < key) {
+        if (norm[mid] < p || (norm[mid] == p && ordered_less(data[mid].key_, key))) {
             l = mid + 1;
         }
         else {
@@ -151,24 +266,1622 @@ int PAGE_TYPE::lower_bound(const KeyType& key) const {
     return ans;
 }
 
-PAGE_TEMPLATE_ARGS
-KEYPAIR_TYPE PAGE_TYPE::front() const {
-    if (!size_) {
-        return KEYPAIR_TYPE();
-    }
-    else {
-        return data_[0];
+KEYPAIR_TEMPLATE_ARGS
+int upper_bound(const uint64_t* norm, uint64_t p, const KEYPAIR_TYPE* data, size_t size, const KeyType& key) {
+    int l = 0, r = static_cast<int>(size) - 1, mid = -1, ans = r;
+    while (l <= r) {
+        mid = (l + r) / 2;
+        if (p < norm[mid] || (p == norm[mid] && ordered_less(key, data[mid].key_))) {
+            ans = mid;
+            r = mid - 1;
+        }
+        else {
+            l = mid + 1;
+        }
     }
+    return ans;
 }
 
-PAGE_TEMPLATE_ARGS
-KEYPAIR_TYPE PAGE_TYPE::back() const {
-    if (!size_) {
-        return KEYPAIR_TYPE();
-    }
-    else {
-        return data_[size_ - 1];
+struct PageHeader {
+    PageType type_ = PageType::Invalid;
+    size_t size_ = 0;
+};
+
+// Leaf layouts share one interface. The tree sizes pages by weight: an entry count for
+// fixed slots, encoded bytes for packed pages. A page whose weight exceeds MAX_WEIGHT is
+// split, and one below MIN_WEIGHT is rebalanced. append_run copies the values of the entries
+// from idx up to the end of idx's key in the page and returns the index past them;
+// repeats_key tells whether an entry is stored without its key because it repeats the
+// previous one.
+//
+// FixedLeafPage is slotted: entries stay in the cell they were written to, in arrival order,
+// and a sorted array of 16-bit cell numbers gives the key order. Inserts and erases shift
+// only that array. Erased cells are reclaimed when the next insert finds no cell past
+// heap_end_; compaction rewrites the cells in key order.
+LEAF_PAGE_TEMPLATE_ARGS
+struct FixedLeafPage : PageHeader {
+    constexpr static bool COMPRESSED = false;
+    constexpr static size_t SLOT_COUNT = (PAGE_SIZE - sizeof(PageHeader) - 2 * sizeof(diskpos_t) - sizeof(uint16_t) - alignof(KEYPAIR_TYPE))
+                                         / (sizeof(KEYPAIR_TYPE) + sizeof(uint16_t));
+    constexpr static size_t MAX_WEIGHT = SLOT_COUNT - 1;
+    constexpr static size_t MIN_WEIGHT = SLOT_COUNT / 2;
+    static_assert(SLOT_COUNT >= 4, "Page is too small for this key type!");
+    static_assert(SLOT_COUNT <= UINT16_MAX, "Cell numbers must fit in a slot!");
+
+    diskpos_t left_ = -1;
+    diskpos_t right_ = -1;
+    uint16_t heap_end_ = 0;
+    uint16_t slots_[SLOT_COUNT];
+    KEYPAIR_TYPE data_[SLOT_COUNT];
+
+    FixedLeafPage() { type_ = PageType::Leaf; }
+
+    int lower_bound(const KEYPAIR_TYPE& kp) const;
+
+    int lower_bound(const KeyType& key) const;
+
+    int upper_bound(const KeyType& key) const;
+
+    const KEYPAIR_TYPE& at(int idx) const;
+
+    KEYPAIR_TYPE front() const;
+
+    KEYPAIR_TYPE back() const;
+
+    bool insert_at(int idx, const KEYPAIR_TYPE& kp);
+
+    void erase_at(int idx);
+
+    void assign(const KEYPAIR_TYPE* data, size_t n);
+
+    void append_to(std::vector<KEYPAIR_TYPE>& out) const;
+
+    bool repeats_key(int idx) const;
+
+    ValueType value_at(int idx) const;
+
+    int append_run(int idx, std::vector<ValueType>& out) const;
+
+    size_t weight() const;
+
+    bool overfull() const;
+
+    bool underfull() const;
+
+    bool safe_insert() const;
+
+    bool safe_erase() const;
+
+    static size_t key_length(const KeyType& key);
+
+    static size_t common_prefix(const KeyType& a, const KeyType& b);
+
+    static size_t weight(size_t n, size_t heads, size_t key_bytes, size_t prefix);
+
+private:
+    void compact();
+};
+
+// Slotted leaf for keys with a byte representation. Body layout: a sorted array of 16-bit
+// entry offsets at the front, entries growing down from the back, and the prefix shared by
+// every key in the page stored once at the very end. An entry is the key length past the
+// prefix (one byte), the key suffix and the value. Entries with the same key as their
+// predecessor form a posting list: the key is stored only by the first entry of the run, the
+// others hold just the value and set REPEAT in their slot. Erased entries leave garbage that
+// is compacted away once the free gap runs out.
+LEAF_PAGE_TEMPLATE_ARGS
+struct PackedLeafPage : PageHeader {
+    static_assert(sizeof(KeyType) <= UINT8_MAX, "Packed leaves store key lengths in one byte!");
+    static_assert(PAGE_SIZE <= UINT16_MAX, "Packed leaves address entries with 16-bit offsets!");
+    static_assert(has_operator_less_v<KeyType>, "Packed leaves need ordered keys!");
+
+    constexpr static bool COMPRESSED = true;
+    constexpr static size_t BODY_SIZE = PAGE_SIZE - sizeof(PageHeader) - 2 * sizeof(diskpos_t) - 3 * sizeof(uint16_t);
+    constexpr static uint16_t REPEAT = 0x8000;
+    static_assert(BODY_SIZE <= REPEAT, "Entry offsets must leave the top slot bit free!");
+    constexpr static size_t REPEAT_ENTRY = sizeof(uint16_t) + sizeof(ValueType);
+    constexpr static size_t ENTRY_OVERHEAD = REPEAT_ENTRY + sizeof(uint8_t);
+    constexpr static size_t MAX_ENTRY = ENTRY_OVERHEAD + sizeof(KeyType);
+    constexpr static size_t MAX_WEIGHT = BODY_SIZE - MAX_ENTRY;
+    constexpr static size_t MIN_WEIGHT = MAX_WEIGHT / 2;
+    constexpr static size_t SLOT_COUNT = MAX_WEIGHT / MAX_ENTRY;
+    static_assert(SLOT_COUNT >= 4, "Page is too small for this key type!");
+
+    diskpos_t left_ = -1;
+    diskpos_t right_ = -1;
+    uint16_t prefix_ = 0;
+    uint16_t heap_ = BODY_SIZE;
+    uint16_t garbage_ = 0;
+    char body_[BODY_SIZE];
+
+    PackedLeafPage() { type_ = PageType::Leaf; }
+
+    int lower_bound(const KEYPAIR_TYPE& kp) const;
+
+    int lower_bound(const KeyType& key) const;
+
+    int upper_bound(const KeyType& key) const;
+
+    KEYPAIR_TYPE at(int idx) const;
+
+    KEYPAIR_TYPE front() const;
+
+    KEYPAIR_TYPE back() const;
+
+    bool insert_at(int idx, const KEYPAIR_TYPE& kp);
+
+    void erase_at(int idx);
+
+    void assign(const KEYPAIR_TYPE* data, size_t n);
+
+    void append_to(std::vector<KEYPAIR_TYPE>& out) const;
+
+    bool repeats_key(int idx) const;
+
+    ValueType value_at(int idx) const;
+
+    int append_run(int idx, std::vector<ValueType>& out) const;
+
+    size_t weight() const;
+
+    bool overfull() const;
+
+    bool underfull() const;
+
+    bool safe_insert() const;
+
+    bool safe_erase() const;
+
+    static size_t key_length(const KeyType& key);
+
+    static size_t common_prefix(const KeyType& a, const KeyType& b);
+
+    static size_t weight(size_t n, size_t heads, size_t key_bytes, size_t prefix);
+
+    static bool same_key(const KeyType& a, size_t a_len, const KeyType& b, size_t b_len);
+
+private:
+    const uint16_t* slots() const;
+
+    uint16_t* slots();
+
+    const char* prefix_data() const;
+
+    size_t offset(int idx) const;
+
+    size_t entry_size(int idx) const;
+
+    int run_head(int idx) const;
+
+    int run_end(int idx) const;
+
+    int against_prefix(const char* key, size_t len) const;
+
+    // idx must hold a stored key, i.e. start a run.
+    int compare(int idx, const char* key, size_t len) const;
+
+    int bound(const char* key, size_t len, bool upper) const;
+
+    void put(int idx, const char* suffix, size_t len, const ValueType& val);
+
+    void put_repeat(int idx, const ValueType& val);
+
+    void compact();
+};
+
+// Leaf for integral keys: keys and values live in separate arrays, so a search touches only
+// the key column and can compare several keys per instruction (see search.hpp).
+LEAF_PAGE_TEMPLATE_ARGS
+struct ColumnLeafPage : PageHeader {
+    constexpr static bool COMPRESSED = false;
+    constexpr static size_t SLOT_COUNT = (PAGE_SIZE - sizeof(PageHeader) - 2 * sizeof(diskpos_t) - alignof(ValueType)) / (sizeof(KeyType) + sizeof(ValueType));
+    constexpr static size_t MAX_WEIGHT = SLOT_COUNT - 1;
+    constexpr static size_t MIN_WEIGHT = SLOT_COUNT / 2;
+    static_assert(SLOT_COUNT >= 4, "Page is too small for this key type!");
+
+    diskpos_t left_ = -1;
+    diskpos_t right_ = -1;
+    KeyType keys_[SLOT_COUNT];
+    ValueType vals_[SLOT_COUNT];
+
+    ColumnLeafPage() { type_ = PageType::Leaf; }
+
+    int lower_bound(const KEYPAIR_TYPE& kp) const;
+
+    int lower_bound(const KeyType& key) const;
+
+    int upper_bound(const KeyType& key) const;
+
+    KEYPAIR_TYPE at(int idx) const;
+
+    KEYPAIR_TYPE front() const;
+
+    KEYPAIR_TYPE back() const;
+
+    bool insert_at(int idx, const KEYPAIR_TYPE& kp);
+
+    void erase_at(int idx);
+
+    void assign(const KEYPAIR_TYPE* data, size_t n);
+
+    void append_to(std::vector<KEYPAIR_TYPE>& out) const;
+
+    bool repeats_key(int idx) const;
+
+    ValueType value_at(int idx) const;
+
+    int append_run(int idx, std::vector<ValueType>& out) const;
+
+    size_t weight() const;
+
+    bool overfull() const;
+
+    bool underfull() const;
+
+    bool safe_insert() const;
+
+    bool safe_erase() const;
+
+    static size_t key_length(const KeyType& key);
+
+    static size_t common_prefix(const KeyType& a, const KeyType& b);
+
+    static size_t weight(size_t n, size_t heads, size_t key_bytes, size_t prefix);
+};
+
+LEAF_PAGE_TEMPLATE_ARGS
+using LeafPage = std::conditional_t<has_key_bytes_v<KeyType>, PACKED_LEAF_PAGE_TYPE,
+                                    std::conditional_t<is_search_integral_v<KeyType>, COLUMN_LEAF_PAGE_TYPE, FIXED_LEAF_PAGE_TYPE>>;
+
+// Weighs contiguous ranges of a sorted entry sequence as if each range were laid out in a
+// fresh leaf, and plans how split, borrow, merge and bulk paths cut the sequence.
+LEAF_RUN_TEMPLATE_ARGS
+class LeafRun {
+private:
+    const KEYPAIR_TYPE* data_;
+    size_t size_;
+    std::vector<size_t> bytes_;
+    std::vector<size_t> heads_;
+
+public:
+    LeafRun(const KEYPAIR_TYPE* data, size_t size);
+
+    size_t weight(size_t i, size_t j) const;
+
+    bool fits(size_t i, size_t j) const;
+
+    bool underfull(size_t i, size_t j) const;
+
+    size_t split_point() const;
+
+    size_t take_from_left(size_t cut) const;
+
+    size_t take_from_right(size_t cut) const;
+
+    std::vector<size_t> chunks() const;
+};
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+struct InternalPage : PageHeader {
+    // Keys with byte spans keep a normalized prefix per slot, so most probes compare one
+    // integer instead of the full key. The prefix is taken after the prefix_ bytes that all
+    // pivots share, so pivots with a long common prefix still differ in it.
+    constexpr static bool NORMALIZED = has_key_bytes_v<KeyType>;
+    constexpr static size_t SLOT_COUNT = (PAGE_SIZE - sizeof(PageHeader) - 2 * sizeof(size_t) - (NORMALIZED ? 0 : sizeof(uint64_t)))
+                                         / (sizeof(KEYPAIR_TYPE) + sizeof(diskpos_t) + (NORMALIZED ? sizeof(uint64_t) : 0));
+    static_assert(SLOT_COUNT >= 4, "Page is too small for this key type!");
+
+    // Pending messages fill the slots from the top down, sorted by pair, with the operation
+    // in ch_; pivots grow from the bottom and the two meet in the middle.
+    size_t messages_ = 0;
+    size_t prefix_ = 0;
+    diskpos_t ch_[SLOT_COUNT];
+    uint64_t norm_[NORMALIZED ? SLOT_COUNT : 1];
+    KEYPAIR_TYPE data_[SLOT_COUNT];
+
+    InternalPage() { type_ = PageType::Internal; }
+
+    int lower_bound(const KEYPAIR_TYPE& kp) const;
+
+    int lower_bound(const KeyType& key) const;
+
+    int upper_bound(const KeyType& key) const;
+
+    // Where key falls against the bytes all pivots share: -1 below every pivot, 1 above
+    // every pivot, 0 when it shares them and the normalized prefixes decide.
+    int against_prefix(const KeyType& key) const;
+
+    // Normalizes the pivot just written at idx. A write at either end, or one that breaks the
+    // shared bytes, goes through refresh_prefix instead. Writes past size_ only stage the
+    // pivot; whoever then sets size_ calls refresh_prefix.
+    void normalize(int idx);
+
+    // Recomputes prefix_ from the pivots and renormalizes all of them.
+    void refresh_prefix();
+
+    KEYPAIR_TYPE back() const;
+
+    void set_at(int idx, const KEYPAIR_TYPE& kp);
+
+    void insert_at(int idx, const KEYPAIR_TYPE& kp, diskpos_t ch);
+
+    void erase_at(int idx);
+
+    size_t free_slots() const;
+
+    const KEYPAIR_TYPE& message_at(size_t i) const;
+
+    MessageOp message_op(size_t i) const;
+
+    // Message ranks, counted like std::lower_bound and std::upper_bound.
+    size_t message_lower_bound(const KEYPAIR_TYPE& kp) const;
+
+    size_t message_upper_bound(const KEYPAIR_TYPE& kp) const;
+
+    size_t message_lower_bound(const KeyType& key) const;
+
+    size_t message_upper_bound(const KeyType& key) const;
+
+    // Records op for kp, replacing a pending message for the same pair. True when the
+    // message is new; a new message needs a free slot.
+    bool put_message(const KEYPAIR_TYPE& kp, MessageOp op);
+
+    // Appends messages [i, j) to out and removes them from the page.
+    void take_messages(size_t i, size_t j, std::vector<std::pair<KEYPAIR_TYPE, MessageOp>>& out);
+
+    // Replaces the messages with n sorted ones.
+    void assign_messages(const std::pair<KEYPAIR_TYPE, MessageOp>* msgs, size_t n);
+};
+
+PAGE_TEMPLATE_ARGS
+struct Page {
+    alignas(PAGE_ALIGNMENT) char bytes_[PAGE_FRAME_SIZE];
+
+    static_assert(sizeof(LEAF_PAGE_TYPE) <= PAGE_SIZE, "Leaf page overflows the page frame!");
+    static_assert(sizeof(INTERNAL_PAGE_TYPE) <= PAGE_SIZE, "Internal page overflows the page frame!");
+
+    Page() = default;
+
+    Page(const Page&) = default;
+
+    ~Page() = default;
+
+    PageType type() const;
+
+    LEAF_PAGE_TYPE& init_leaf();
+
+    INTERNAL_PAGE_TYPE& init_internal();
+
+    LEAF_PAGE_TYPE& as_leaf();
+
+    const LEAF_PAGE_TYPE& as_leaf() const;
+
+    INTERNAL_PAGE_TYPE& as_internal();
+
+    const INTERNAL_PAGE_TYPE& as_internal() const;
+
+    PageHeader& header();
+
+    const PageHeader& header() const;
+
+    size_t capacity() const;
+
+    KEYPAIR_TYPE back() const;
+
+};
+
+LEAF_PAGE_TEMPLATE_ARGS
+int FIXED_LEAF_PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
+    return sjtu::lower_bound(slots_, data_, size_, kp);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int FIXED_LEAF_PAGE_TYPE::lower_bound(const KeyType& key) const {
+    return sjtu::lower_bound(slots_, data_, size_, key);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int FIXED_LEAF_PAGE_TYPE::upper_bound(const KeyType& key) const {
+    return sjtu::upper_bound(slots_, data_, size_, key);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+const KEYPAIR_TYPE& FIXED_LEAF_PAGE_TYPE::at(int idx) const {
+    return data_[slots_[idx]];
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE FIXED_LEAF_PAGE_TYPE::front() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(0);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE FIXED_LEAF_PAGE_TYPE::back() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(size_ - 1);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void FIXED_LEAF_PAGE_TYPE::compact() {
+    KEYPAIR_TYPE buf[SLOT_COUNT];
+    for (size_t i = 0; i < size_; i++) {
+        buf[i] = data_[slots_[i]];
+    }
+    for (size_t i = 0; i < size_; i++) {
+        data_[i] = buf[i];
+        slots_[i] = static_cast<uint16_t>(i);
+    }
+    heap_end_ = static_cast<uint16_t>(size_);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::insert_at(int idx, const KEYPAIR_TYPE& kp) {
+    if (size_ == SLOT_COUNT) {
+        return false;
+    }
+    if (heap_end_ == SLOT_COUNT) {
+        compact();
+    }
+    std::memmove(slots_ + idx + 1, slots_ + idx, (size_ - idx) * sizeof(uint16_t));
+    slots_[idx] = heap_end_;
+    data_[heap_end_++] = kp;
+    size_++;
+    return true;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void FIXED_LEAF_PAGE_TYPE::erase_at(int idx) {
+    // The last cell is given back at once; other cells wait for compaction.
+    if (slots_[idx] + 1 == heap_end_) {
+        heap_end_--;
+    }
+    std::memmove(slots_ + idx, slots_ + idx + 1, (size_ - idx - 1) * sizeof(uint16_t));
+    size_--;
+    if (!size_) {
+        heap_end_ = 0;
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void FIXED_LEAF_PAGE_TYPE::assign(const KEYPAIR_TYPE* data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        data_[i] = data[i];
+        slots_[i] = static_cast<uint16_t>(i);
+    }
+    size_ = n;
+    heap_end_ = static_cast<uint16_t>(n);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void FIXED_LEAF_PAGE_TYPE::append_to(std::vector<KEYPAIR_TYPE>& out) const {
+    for (size_t i = 0; i < size_; i++) {
+        out.push_back(data_[slots_[i]]);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::repeats_key(int) const {
+    return false;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+ValueType FIXED_LEAF_PAGE_TYPE::value_at(int idx) const {
+    return at(idx).val_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int FIXED_LEAF_PAGE_TYPE::append_run(int idx, std::vector<ValueType>& out) const {
+    const KeyType& key = at(idx).key_;
+    int end = idx;
+    while (end < static_cast<int>(size_) && !ordered_less(key, at(end).key_)) {
+        out.push_back(at(end).val_);
+        end++;
+    }
+    return end;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t FIXED_LEAF_PAGE_TYPE::weight() const {
+    return size_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::overfull() const {
+    return size_ > MAX_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::underfull() const {
+    return size_ < MIN_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::safe_insert() const {
+    return size_ + 1 < SLOT_COUNT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool FIXED_LEAF_PAGE_TYPE::safe_erase() const {
+    return size_ > MIN_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t FIXED_LEAF_PAGE_TYPE::key_length(const KeyType&) {
+    return 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t FIXED_LEAF_PAGE_TYPE::common_prefix(const KeyType&, const KeyType&) {
+    return 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t FIXED_LEAF_PAGE_TYPE::weight(size_t n, size_t, size_t, size_t) {
+    return n;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+const uint16_t* PACKED_LEAF_PAGE_TYPE::slots() const {
+    return reinterpret_cast<const uint16_t *>(body_);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+uint16_t* PACKED_LEAF_PAGE_TYPE::slots() {
+    return reinterpret_cast<uint16_t *>(body_);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+const char* PACKED_LEAF_PAGE_TYPE::prefix_data() const {
+    return body_ + BODY_SIZE - prefix_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::offset(int idx) const {
+    return slots()[idx] & ~REPEAT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::entry_size(int idx) const {
+    if (repeats_key(idx)) {
+        return sizeof(ValueType);
+    }
+    return sizeof(uint8_t) + static_cast<uint8_t>(body_[offset(idx)]) + sizeof(ValueType);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::run_head(int idx) const {
+    const uint16_t* s = slots();
+    while (s[idx] & REPEAT) {
+        idx--;
+    }
+    return idx;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::run_end(int idx) const {
+    const uint16_t* s = slots();
+    int n = static_cast<int>(size_);
+    idx++;
+    while (idx < n && (s[idx] & REPEAT)) {
+        idx++;
+    }
+    return idx;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::against_prefix(const char* key, size_t len) const {
+    int c = std::memcmp(key, prefix_data(), std::min<size_t>(len, prefix_));
+    if (c != 0) {
+        return c < 0 ? -1 : 1;
+    }
+    return len < prefix_ ? -1 : 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::compare(int idx, const char* key, size_t len) const {
+    const char* entry = body_ + offset(idx);
+    size_t stored = static_cast<uint8_t>(entry[0]);
+    size_t wanted = len - prefix_;
+    int c = std::memcmp(entry + sizeof(uint8_t), key + prefix_, std::min(stored, wanted));
+    if (c != 0) {
+        return c;
+    }
+    return (stored > wanted) - (stored < wanted);
+}
+
+// First entry whose key is above (upper) or not below the given one, size_ if none. A probe
+// that lands inside a run is resolved at the run's head, and the whole run is then skipped,
+// so each run is walked at most once.
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::bound(const char* key, size_t len, bool upper) const {
+    int side = against_prefix(key, len);
+    if (side != 0) {
+        return side < 0 ? 0 : static_cast<int>(size_);
+    }
+    int l = 0, r = static_cast<int>(size_) - 1, ans = static_cast<int>(size_);
+    while (l <= r) {
+        int mid = (l + r) / 2;
+        bool repeat = repeats_key(mid);
+        int head = repeat ? run_head(mid) : mid;
+        int c = compare(head, key, len);
+        if (c < 0 || (upper && c == 0)) {
+            l = repeat ? run_end(mid) : mid + 1;
+        }
+        else {
+            ans = head;
+            r = head - 1;
+        }
+    }
+    return ans;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+ValueType PACKED_LEAF_PAGE_TYPE::value_at(int idx) const {
+    const char* entry = body_ + offset(idx);
+    if (!repeats_key(idx)) {
+        entry += sizeof(uint8_t) + static_cast<uint8_t>(entry[0]);
+    }
+    ValueType val;
+    std::memcpy(static_cast<void *>(&val), entry, sizeof(ValueType));
+    return val;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::put(int idx, const char* suffix, size_t len, const ValueType& val) {
+    heap_ -= sizeof(uint8_t) + len + sizeof(ValueType);
+    char* entry = body_ + heap_;
+    entry[0] = static_cast<char>(len);
+    std::memcpy(entry + sizeof(uint8_t), suffix, len);
+    std::memcpy(entry + sizeof(uint8_t) + len, &val, sizeof(ValueType));
+    slots()[idx] = heap_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::put_repeat(int idx, const ValueType& val) {
+    heap_ -= sizeof(ValueType);
+    std::memcpy(body_ + heap_, &val, sizeof(ValueType));
+    slots()[idx] = heap_ | REPEAT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::compact() {
+    char buf[BODY_SIZE];
+    size_t top = BODY_SIZE - prefix_;
+    for (int i = 0; i < static_cast<int>(size_); i++) {
+        size_t len = entry_size(i);
+        top -= len;
+        std::memcpy(buf + top, body_ + offset(i), len);
+        slots()[i] = static_cast<uint16_t>(top | (slots()[i] & REPEAT));
+    }
+    std::memcpy(body_ + top, buf + top, BODY_SIZE - prefix_ - top);
+    heap_ = static_cast<uint16_t>(top);
+    garbage_ = 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
+    int l = 0, r = static_cast<int>(size_) - 1, mid = -1, ans = r;
+    if (!size_) {
+        return ans;
+    }
+    const char* key = kp.key_.key_data();
+    size_t len = kp.key_.key_size();
+    int side = against_prefix(key, len);
+    if (side != 0) {
+        return side < 0 ? 0 : ans;
+    }
+    while (l <= r) {
+        mid = (l + r) / 2;
+        bool repeat = repeats_key(mid);
+        int head = repeat ? run_head(mid) : mid;
+        int c = compare(head, key, len);
+        if (c == 0 && repeat) {
+            // Inside the key's run: the rest is a search over its values alone.
+            int lo = std::max(l, head), hi = std::min(r + 1, run_end(mid));
+            while (lo < hi) {
+                int m = (lo + hi) / 2;
+                if (ordered_less(value_at(m), kp.val_)) {
+                    lo = m + 1;
+                }
+                else {
+                    hi = m;
+                }
+            }
+            if (lo <= r) {
+                ans = lo;
+            }
+            break;
+        }
+        if (c < 0 || (c == 0 && ordered_less(value_at(mid), kp.val_))) {
+            l = repeat ? run_end(mid) : mid + 1;
+        }
+        else {
+            ans = head;
+            r = head - 1;
+        }
+    }
+    return ans;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::lower_bound(const KeyType& key) const {
+    if (!size_) {
+        return -1;
+    }
+    return std::min(bound(key.key_data(), key.key_size(), false), static_cast<int>(size_) - 1);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::upper_bound(const KeyType& key) const {
+    if (!size_) {
+        return -1;
+    }
+    return std::min(bound(key.key_data(), key.key_size(), true), static_cast<int>(size_) - 1);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE PACKED_LEAF_PAGE_TYPE::at(int idx) const {
+    KEYPAIR_TYPE kp;
+    char key[sizeof(KeyType)];
+    const char* entry = body_ + offset(run_head(idx));
+    size_t suffix = static_cast<uint8_t>(entry[0]);
+    std::memcpy(key, prefix_data(), prefix_);
+    std::memcpy(key + prefix_, entry + sizeof(uint8_t), suffix);
+    kp.key_.assign_key(key, prefix_ + suffix);
+    kp.val_ = value_at(idx);
+    return kp;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE PACKED_LEAF_PAGE_TYPE::front() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(0);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE PACKED_LEAF_PAGE_TYPE::back() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(static_cast<int>(size_) - 1);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::insert_at(int idx, const KEYPAIR_TYPE& kp) {
+    if (!size_) {
+        assign(&kp, 1);
+        return true;
+    }
+    const char* key = kp.key_.key_data();
+    size_t len = kp.key_.key_size();
+    size_t shared = std::mismatch(key, key + std::min<size_t>(len, prefix_), prefix_data()).first - key;
+    if (shared < prefix_) {
+        // The key leaves the shared prefix: every stored key grows, so re-encode the whole page.
+        size_t heads = 0;
+        for (int i = 0; i < static_cast<int>(size_); i++) {
+            heads += !repeats_key(i);
+        }
+        size_t need = weight() + (prefix_ - shared) * heads + ENTRY_OVERHEAD + len - shared;
+        if (need > BODY_SIZE) {
+            return false;
+        }
+        std::vector<KEYPAIR_TYPE> entries;
+        entries.reserve(size_ + 1);
+        append_to(entries);
+        entries.insert(entries.begin() + idx, kp);
+        assign(entries.data(), entries.size());
+        return true;
+    }
+    // Joining the previous entry's run stores the value alone; starting a run in front of an
+    // equal key turns the old head into a repeat.
+    bool repeat = idx > 0 && compare(run_head(idx - 1), key, len) == 0;
+    bool absorb = !repeat && idx < static_cast<int>(size_) && compare(idx, key, len) == 0;
+    size_t entry = repeat ? sizeof(ValueType) : sizeof(uint8_t) + len - prefix_ + sizeof(ValueType);
+    if (weight() + entry + sizeof(uint16_t) > BODY_SIZE) {
+        return false;
+    }
+    if (heap_ < entry + (size_ + 1) * sizeof(uint16_t)) {
+        compact();
+    }
+    std::memmove(slots() + idx + 1, slots() + idx, (size_ - idx) * sizeof(uint16_t));
+    if (repeat) {
+        put_repeat(idx, kp.val_);
+    }
+    else {
+        put(idx, key + prefix_, len - prefix_, kp.val_);
+    }
+    if (absorb) {
+        size_t old = slots()[idx + 1];
+        size_t suffix = static_cast<uint8_t>(body_[old]);
+        slots()[idx + 1] = static_cast<uint16_t>((old + sizeof(uint8_t) + suffix) | REPEAT);
+        garbage_ += sizeof(uint8_t) + suffix;
+    }
+    size_++;
+    return true;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::erase_at(int idx) {
+    bool promote = !repeats_key(idx) && idx + 1 < static_cast<int>(size_) && repeats_key(idx + 1);
+    char suffix[sizeof(KeyType)];
+    size_t len = 0;
+    if (promote) {
+        const char* entry = body_ + offset(idx);
+        len = static_cast<uint8_t>(entry[0]);
+        std::memcpy(suffix, entry + sizeof(uint8_t), len);
+    }
+    garbage_ += entry_size(idx);
+    std::memmove(slots() + idx, slots() + idx + 1, (size_ - idx - 1) * sizeof(uint16_t));
+    size_--;
+    if (!size_) {
+        prefix_ = 0;
+        heap_ = BODY_SIZE;
+        garbage_ = 0;
+        return;
+    }
+    if (promote) {
+        // The next entry inherits the key and now has to store it.
+        size_t need = sizeof(uint8_t) + len + sizeof(ValueType);
+        if (heap_ < need + size_ * sizeof(uint16_t)) {
+            compact();
+        }
+        ValueType val = value_at(idx);
+        garbage_ += sizeof(ValueType);
+        put(idx, suffix, len, val);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::assign(const KEYPAIR_TYPE* data, size_t n) {
+    prefix_ = n ? static_cast<uint16_t>(common_prefix(data[0].key_, data[n - 1].key_)) : 0;
+    heap_ = static_cast<uint16_t>(BODY_SIZE - prefix_);
+    garbage_ = 0;
+    if (n) {
+        std::memcpy(body_ + heap_, data[0].key_.key_data(), prefix_);
+    }
+    size_t last = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = data[i].key_.key_size();
+        if (i > 0 && same_key(data[i - 1].key_, last, data[i].key_, len)) {
+            put_repeat(static_cast<int>(i), data[i].val_);
+        }
+        else {
+            put(static_cast<int>(i), data[i].key_.key_data() + prefix_, len - prefix_, data[i].val_);
+        }
+        last = len;
+    }
+    size_ = n;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void PACKED_LEAF_PAGE_TYPE::append_to(std::vector<KEYPAIR_TYPE>& out) const {
+    for (int i = 0; i < static_cast<int>(size_); i++) {
+        if (repeats_key(i)) {
+            out.push_back(out.back());
+            out.back().val_ = value_at(i);
+        }
+        else {
+            out.push_back(at(i));
+        }
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::repeats_key(int idx) const {
+    return (slots()[idx] & REPEAT) != 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int PACKED_LEAF_PAGE_TYPE::append_run(int idx, std::vector<ValueType>& out) const {
+    int end = run_end(idx);
+    for (int i = idx; i < end; i++) {
+        out.push_back(value_at(i));
+    }
+    return end;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::weight() const {
+    return size_ * sizeof(uint16_t) + (BODY_SIZE - heap_) - garbage_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::overfull() const {
+    return weight() > MAX_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::underfull() const {
+    return weight() < MIN_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::safe_insert() const {
+    return weight() + (size_ + 1) * prefix_ + MAX_ENTRY <= MAX_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::safe_erase() const {
+    return weight() >= MIN_WEIGHT + MAX_ENTRY;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::key_length(const KeyType& key) {
+    return key.key_size();
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::common_prefix(const KeyType& a, const KeyType& b) {
+    const char* x = a.key_data();
+    const char* y = b.key_data();
+    size_t n = std::min<size_t>(a.key_size(), b.key_size());
+    return std::mismatch(x, x + n, y).first - x;
+}
+
+// Called on sorted neighbours, which mostly differ in their last byte, so that byte is
+// checked before the full compare.
+LEAF_PAGE_TEMPLATE_ARGS
+bool PACKED_LEAF_PAGE_TYPE::same_key(const KeyType& a, size_t a_len, const KeyType& b, size_t b_len) {
+    if (a_len != b_len) {
+        return false;
+    }
+    if (a_len == 0) {
+        return true;
+    }
+    const char* x = a.key_data();
+    const char* y = b.key_data();
+    return x[a_len - 1] == y[a_len - 1] && std::memcmp(x, y, a_len - 1) == 0;
+}
+
+// n entries of which heads start a run and store their keys; key_bytes is the total length
+// of those keys.
+LEAF_PAGE_TEMPLATE_ARGS
+size_t PACKED_LEAF_PAGE_TYPE::weight(size_t n, size_t heads, size_t key_bytes, size_t prefix) {
+    if (!n) {
+        return 0;
+    }
+    return n * REPEAT_ENTRY + heads * sizeof(uint8_t) + key_bytes - heads * prefix + prefix;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int COLUMN_LEAF_PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
+    if (!size_) {
+        return -1;
+    }
+    size_t l = rank<false>(keys_, size_, kp.key_);
+    size_t r = l;
+    if (l < size_ && !(kp.key_ < keys_[l])) {
+        r += rank<true>(keys_ + l, size_ - l, kp.key_);
+    }
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (ordered_less(vals_[mid], kp.val_)) {
+            l = mid + 1;
+        }
+        else {
+            r = mid;
+        }
+    }
+    return (l == size_) ? static_cast<int>(size_) - 1 : static_cast<int>(l);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int COLUMN_LEAF_PAGE_TYPE::lower_bound(const KeyType& key) const {
+    size_t k = rank<false>(keys_, size_, key);
+    return (k == size_) ? static_cast<int>(size_) - 1 : static_cast<int>(k);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int COLUMN_LEAF_PAGE_TYPE::upper_bound(const KeyType& key) const {
+    size_t k = rank<true>(keys_, size_, key);
+    return (k == size_) ? static_cast<int>(size_) - 1 : static_cast<int>(k);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE COLUMN_LEAF_PAGE_TYPE::at(int idx) const {
+    return KEYPAIR_TYPE(keys_[idx], vals_[idx]);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE COLUMN_LEAF_PAGE_TYPE::front() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(0);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE COLUMN_LEAF_PAGE_TYPE::back() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return at(static_cast<int>(size_) - 1);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::insert_at(int idx, const KEYPAIR_TYPE& kp) {
+    if (size_ == SLOT_COUNT) {
+        return false;
+    }
+    std::memmove(static_cast<void *>(keys_ + idx + 1), keys_ + idx, (size_ - idx) * sizeof(KeyType));
+    std::memmove(static_cast<void *>(vals_ + idx + 1), vals_ + idx, (size_ - idx) * sizeof(ValueType));
+    keys_[idx] = kp.key_;
+    vals_[idx] = kp.val_;
+    size_++;
+    return true;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void COLUMN_LEAF_PAGE_TYPE::erase_at(int idx) {
+    std::memmove(static_cast<void *>(keys_ + idx), keys_ + idx + 1, (size_ - idx - 1) * sizeof(KeyType));
+    std::memmove(static_cast<void *>(vals_ + idx), vals_ + idx + 1, (size_ - idx - 1) * sizeof(ValueType));
+    size_--;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void COLUMN_LEAF_PAGE_TYPE::assign(const KEYPAIR_TYPE* data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        keys_[i] = data[i].key_;
+        vals_[i] = data[i].val_;
+    }
+    size_ = n;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void COLUMN_LEAF_PAGE_TYPE::append_to(std::vector<KEYPAIR_TYPE>& out) const {
+    for (size_t i = 0; i < size_; i++) {
+        out.emplace_back(keys_[i], vals_[i]);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::repeats_key(int) const {
+    return false;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+ValueType COLUMN_LEAF_PAGE_TYPE::value_at(int idx) const {
+    return vals_[idx];
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int COLUMN_LEAF_PAGE_TYPE::append_run(int idx, std::vector<ValueType>& out) const {
+    int end = idx;
+    while (end < static_cast<int>(size_) && keys_[end] == keys_[idx]) {
+        out.push_back(vals_[end]);
+        end++;
+    }
+    return end;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t COLUMN_LEAF_PAGE_TYPE::weight() const {
+    return size_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::overfull() const {
+    return size_ > MAX_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::underfull() const {
+    return size_ < MIN_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::safe_insert() const {
+    return size_ + 1 < SLOT_COUNT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+bool COLUMN_LEAF_PAGE_TYPE::safe_erase() const {
+    return size_ > MIN_WEIGHT;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t COLUMN_LEAF_PAGE_TYPE::key_length(const KeyType&) {
+    return 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t COLUMN_LEAF_PAGE_TYPE::common_prefix(const KeyType&, const KeyType&) {
+    return 0;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+size_t COLUMN_LEAF_PAGE_TYPE::weight(size_t n, size_t, size_t, size_t) {
+    return n;
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+LEAF_RUN_TYPE::LeafRun(const KEYPAIR_TYPE* data, size_t size) : data_(data), size_(size) {
+    if constexpr (LEAF_PAGE_TYPE::COMPRESSED) {
+        // Only the first entry of each run of equal keys stores its key.
+        bytes_.resize(size + 1);
+        heads_.resize(size + 1);
+        size_t last = 0;
+        for (size_t i = 0; i < size; i++) {
+            size_t len = LEAF_PAGE_TYPE::key_length(data[i].key_);
+            bool head = (i == 0 || !LEAF_PAGE_TYPE::same_key(data[i - 1].key_, last, data[i].key_, len));
+            bytes_[i + 1] = bytes_[i] + (head ? len : 0);
+            heads_[i + 1] = heads_[i] + head;
+            last = len;
+        }
+    }
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+size_t LEAF_RUN_TYPE::weight(size_t i, size_t j) const {
+    if constexpr (!LEAF_PAGE_TYPE::COMPRESSED) {
+        return j - i;
+    }
+    else {
+        if (i == j) {
+            return 0;
+        }
+        size_t heads = heads_[j] - heads_[i];
+        size_t bytes = bytes_[j] - bytes_[i];
+        if (heads_[i + 1] == heads_[i]) {
+            // The range starts inside a run, so its first entry stores the key in a fresh page.
+            heads++;
+            bytes += LEAF_PAGE_TYPE::key_length(data_[i].key_);
+        }
+        return LEAF_PAGE_TYPE::weight(j - i, heads, bytes, LEAF_PAGE_TYPE::common_prefix(data_[i].key_, data_[j - 1].key_));
+    }
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+bool LEAF_RUN_TYPE::fits(size_t i, size_t j) const {
+    return weight(i, j) <= LEAF_PAGE_TYPE::MAX_WEIGHT;
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+bool LEAF_RUN_TYPE::underfull(size_t i, size_t j) const {
+    return weight(i, j) < LEAF_PAGE_TYPE::MIN_WEIGHT;
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+size_t LEAF_RUN_TYPE::split_point() const {
+    if constexpr (!LEAF_PAGE_TYPE::COMPRESSED) {
+        return size_ / 2;
+    }
+    else {
+        size_t l = 1, r = size_ - 1;
+        while (l < r) {
+            size_t mid = (l + r) / 2;
+            if (weight(0, mid) >= weight(mid, size_)) {
+                r = mid;
+            }
+            else {
+                l = mid + 1;
+            }
+        }
+        if (l > 1 && std::max(weight(0, l - 1), weight(l - 1, size_)) < std::max(weight(0, l), weight(l, size_))) {
+            l--;
+        }
+        return l;
+    }
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+size_t LEAF_RUN_TYPE::take_from_left(size_t cut) const {
+    auto movable = [this, cut](size_t t) {
+        return !underfull(0, cut - t) && fits(cut - t, size_);
+    };
+    if (cut == 0 || !movable(1)) {
+        return 0;
+    }
+    size_t l = 1, r = cut;
+    while (l < r) {
+        size_t mid = (l + r + 1) / 2;
+        if (movable(mid)) {
+            l = mid;
+        }
+        else {
+            r = mid - 1;
+        }
+    }
+    r = l;
+    l = 1;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (!underfull(cut - mid, size_)) {
+            r = mid;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return l;
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+size_t LEAF_RUN_TYPE::take_from_right(size_t cut) const {
+    auto movable = [this, cut](size_t t) {
+        return !underfull(cut + t, size_) && fits(0, cut + t);
+    };
+    if (cut == size_ || !movable(1)) {
+        return 0;
+    }
+    size_t l = 1, r = size_ - cut;
+    while (l < r) {
+        size_t mid = (l + r + 1) / 2;
+        if (movable(mid)) {
+            l = mid;
+        }
+        else {
+            r = mid - 1;
+        }
+    }
+    r = l;
+    l = 1;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (!underfull(0, cut + mid)) {
+            r = mid;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return l;
+}
+
+LEAF_RUN_TEMPLATE_ARGS
+std::vector<size_t> LEAF_RUN_TYPE::chunks() const {
+    std::vector<size_t> sizes;
+    size_t target = (LEAF_PAGE_TYPE::MAX_WEIGHT + 1) * 3 / 4;
+    size_t k = (weight(0, size_) + target - 1) / target;
+    size_t i = 0;
+    while (i < size_) {
+        size_t left = (k > sizes.size()) ? k - sizes.size() : 1;
+        size_t goal = std::min(target, (weight(i, size_) + left - 1) / left);
+        size_t l = i + 1, r = size_;
+        while (l < r) {
+            size_t mid = (l + r + 1) / 2;
+            if (weight(i, mid) <= goal) {
+                l = mid;
+            }
+            else {
+                r = mid - 1;
+            }
+        }
+        sizes.push_back(l - i);
+        i = l;
+    }
+    return sizes;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
+    if constexpr (NORMALIZED) {
+        int side = against_prefix(kp.key_);
+        if (side) {
+            return (side < 0) ? 0 : static_cast<int>(size_) - 1;
+        }
+        return sjtu::lower_bound(norm_, normalized_prefix(kp.key_, prefix_), data_, size_, kp);
+    }
+    else {
+        return sjtu::lower_bound(data_, size_, kp);
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::lower_bound(const KeyType& key) const {
+    if constexpr (NORMALIZED) {
+        int side = against_prefix(key);
+        if (side) {
+            return (side < 0) ? 0 : static_cast<int>(size_) - 1;
+        }
+        return sjtu::lower_bound(norm_, normalized_prefix(key, prefix_), data_, size_, key);
+    }
+    else {
+        return sjtu::lower_bound(data_, size_, key);
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::upper_bound(const KeyType& key) const {
+    if constexpr (NORMALIZED) {
+        int side = against_prefix(key);
+        if (side) {
+            return (side < 0) ? 0 : static_cast<int>(size_) - 1;
+        }
+        return sjtu::upper_bound(norm_, normalized_prefix(key, prefix_), data_, size_, key);
+    }
+    else {
+        return sjtu::upper_bound(data_, size_, key);
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::against_prefix(const KeyType& key) const {
+    if (!prefix_) {
+        return 0;
+    }
+    size_t len = key.key_size();
+    int c = std::memcmp(key.key_data(), data_[0].key_.key_data(), std::min(len, prefix_));
+    if (c) {
+        return (c < 0) ? -1 : 1;
+    }
+    return (len < prefix_) ? -1 : 0;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::normalize(int idx) {
+    if constexpr (NORMALIZED) {
+        const KeyType& key = data_[idx].key_;
+        int n = static_cast<int>(size_);
+        if (idx < n && (idx == 0 || idx + 1 == n || against_prefix(key))) {
+            refresh_prefix();
+            return;
+        }
+        norm_[idx] = normalized_prefix(key, prefix_);
+    }
+}
+
+// The shared bytes of sorted pivots are those of the first and last, but a page being
+// rewritten may hold pivots out of order for a while, so every pivot is checked.
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::refresh_prefix() {
+    if constexpr (NORMALIZED) {
+        size_t shared = size_ ? data_[0].key_.key_size() : 0;
+        const char* first = size_ ? data_[0].key_.key_data() : nullptr;
+        for (size_t i = 1; i < size_ && shared; i++) {
+            const char* x = data_[i].key_.key_data();
+            size_t n = std::min(shared, data_[i].key_.key_size());
+            shared = std::mismatch(first, first + n, x).first - first;
+        }
+        prefix_ = shared;
+        for (size_t i = 0; i < size_; i++) {
+            norm_[i] = normalized_prefix(data_[i].key_, prefix_);
+        }
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE INTERNAL_PAGE_TYPE::back() const {
+    if (!size_) {
+        return KEYPAIR_TYPE();
+    }
+    else {
+        return data_[size_ - 1];
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::set_at(int idx, const KEYPAIR_TYPE& kp) {
+    data_[idx] = kp;
+    normalize(idx);
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::insert_at(int idx, const KEYPAIR_TYPE& kp, diskpos_t ch) {
+    for (int i = static_cast<int>(size_) - 1; i >= idx; i--) {
+        data_[i + 1] = data_[i];
+        ch_[i + 1] = ch_[i];
+        if constexpr (NORMALIZED) {
+            norm_[i + 1] = norm_[i];
+        }
+    }
+    data_[idx] = kp;
+    ch_[idx] = ch;
+    size_++;
+    normalize(idx);
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::erase_at(int idx) {
+    for (int i = idx; i < static_cast<int>(size_) - 1; i++) {
+        data_[i] = data_[i + 1];
+        ch_[i] = ch_[i + 1];
+        if constexpr (NORMALIZED) {
+            norm_[i] = norm_[i + 1];
+        }
+    }
+    size_--;
+    if (idx == 0 || idx == static_cast<int>(size_)) {
+        refresh_prefix();
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+size_t INTERNAL_PAGE_TYPE::free_slots() const {
+    return SLOT_COUNT - size_ - messages_;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+const KEYPAIR_TYPE& INTERNAL_PAGE_TYPE::message_at(size_t i) const {
+    return data_[SLOT_COUNT - messages_ + i];
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+MessageOp INTERNAL_PAGE_TYPE::message_op(size_t i) const {
+    return static_cast<MessageOp>(ch_[SLOT_COUNT - messages_ + i]);
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+size_t INTERNAL_PAGE_TYPE::message_lower_bound(const KEYPAIR_TYPE& kp) const {
+    size_t l = 0, r = messages_;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (message_at(mid) < kp) {
+            l = mid + 1;
+        }
+        else {
+            r = mid;
+        }
+    }
+    return l;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+size_t INTERNAL_PAGE_TYPE::message_upper_bound(const KEYPAIR_TYPE& kp) const {
+    size_t l = 0, r = messages_;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (kp < message_at(mid)) {
+            r = mid;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return l;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+size_t INTERNAL_PAGE_TYPE::message_lower_bound(const KeyType& key) const {
+    size_t l = 0, r = messages_;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (ordered_less(message_at(mid).key_, key)) {
+            l = mid + 1;
+        }
+        else {
+            r = mid;
+        }
+    }
+    return l;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+size_t INTERNAL_PAGE_TYPE::message_upper_bound(const KeyType& key) const {
+    size_t l = 0, r = messages_;
+    while (l < r) {
+        size_t mid = (l + r) / 2;
+        if (ordered_less(key, message_at(mid).key_)) {
+            r = mid;
+        }
+        else {
+            l = mid + 1;
+        }
+    }
+    return l;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+bool INTERNAL_PAGE_TYPE::put_message(const KEYPAIR_TYPE& kp, MessageOp op) {
+    size_t i = message_lower_bound(kp);
+    size_t base = SLOT_COUNT - messages_;
+    if (i < messages_ && data_[base + i] == kp) {
+        ch_[base + i] = static_cast<diskpos_t>(op);
+        return false;
+    }
+    for (size_t t = 0; t < i; t++) {
+        data_[base + t - 1] = data_[base + t];
+        ch_[base + t - 1] = ch_[base + t];
+    }
+    data_[base + i - 1] = kp;
+    ch_[base + i - 1] = static_cast<diskpos_t>(op);
+    messages_++;
+    return true;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::take_messages(size_t i, size_t j, std::vector<std::pair<KEYPAIR_TYPE, MessageOp>>& out) {
+    size_t base = SLOT_COUNT - messages_;
+    for (size_t t = i; t < j; t++) {
+        out.push_back({data_[base + t], static_cast<MessageOp>(ch_[base + t])});
+    }
+    for (size_t t = i; t-- > 0;) {
+        data_[base + t + j - i] = data_[base + t];
+        ch_[base + t + j - i] = ch_[base + t];
+    }
+    messages_ -= j - i;
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::assign_messages(const std::pair<KEYPAIR_TYPE, MessageOp>* msgs, size_t n) {
+    size_t base = SLOT_COUNT - n;
+    for (size_t t = 0; t < n; t++) {
+        data_[base + t] = msgs[t].first;
+        ch_[base + t] = static_cast<diskpos_t>(msgs[t].second);
+    }
+    messages_ = n;
+}
+
+PAGE_TEMPLATE_ARGS
+PageType PAGE_TYPE::type() const {
+    return header().type_;
+}
+
+PAGE_TEMPLATE_ARGS
+LEAF_PAGE_TYPE& PAGE_TYPE::init_leaf() {
+    std::memset(bytes_, 0, PAGE_FRAME_SIZE);
+    return *new (bytes_) LEAF_PAGE_TYPE();
+}
+
+PAGE_TEMPLATE_ARGS
+INTERNAL_PAGE_TYPE& PAGE_TYPE::init_internal() {
+    std::memset(bytes_, 0, PAGE_FRAME_SIZE);
+    return *new (bytes_) INTERNAL_PAGE_TYPE();
+}
+
+PAGE_TEMPLATE_ARGS
+LEAF_PAGE_TYPE& PAGE_TYPE::as_leaf() {
+    return *reinterpret_cast<LEAF_PAGE_TYPE *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+const LEAF_PAGE_TYPE& PAGE_TYPE::as_leaf() const {
+    return *reinterpret_cast<const LEAF_PAGE_TYPE *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+INTERNAL_PAGE_TYPE& PAGE_TYPE::as_internal() {
+    return *reinterpret_cast<INTERNAL_PAGE_TYPE *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+const INTERNAL_PAGE_TYPE& PAGE_TYPE::as_internal() const {
+    return *reinterpret_cast<const INTERNAL_PAGE_TYPE *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+PageHeader& PAGE_TYPE::header() {
+    return *reinterpret_cast<PageHeader *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+const PageHeader& PAGE_TYPE::header() const {
+    return *reinterpret_cast<const PageHeader *>(bytes_);
+}
+
+PAGE_TEMPLATE_ARGS
+size_t PAGE_TYPE::capacity() const {
+    if (type() == PageType::Leaf) {
+        return LEAF_PAGE_TYPE::SLOT_COUNT;
+    }
+    return INTERNAL_PAGE_TYPE::SLOT_COUNT;
+}
+
+PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE PAGE_TYPE::back() const {
+    if (type() == PageType::Leaf) {
+        return as_leaf().back();
     }
+    return as_internal().back();
 }
 
 } // namespace sjtu
@@ -0,0 +1,102 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "type_helper.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace sjtu {
+
+// Below this many keys the search stops halving and counts the rest with vector compares.
+#if defined(__AVX2__)
+constexpr size_t SEARCH_WINDOW = 32;
+#else
+constexpr size_t SEARCH_WINDOW = 16;
+#endif
+
+// Number of keys in [keys, keys + n) below key (Inclusive: not above key). The keys need not
+// be sorted; every lane is compared and the all-ones masks are summed, so there are no
+// branches on the data.
+template<bool Inclusive, typename T>
+size_t count_below(const T* keys, size_t n, T key) {
+    size_t i = 0;
+    size_t c = 0;
+#if defined(__AVX2__)
+    if constexpr (sizeof(T) == 4 || sizeof(T) == 8) {
+        constexpr bool biased = std::is_unsigned_v<T>;
+        constexpr size_t lanes = 32 / sizeof(T);
+        const __m256i bias = (sizeof(T) == 4) ? _mm256_set1_epi32(INT32_MIN) : _mm256_set1_epi64x(INT64_MIN);
+        __m256i k = (sizeof(T) == 4) ? _mm256_set1_epi32(static_cast<int32_t>(key)) : _mm256_set1_epi64x(static_cast<int64_t>(key));
+        if (biased) {
+            k = _mm256_xor_si256(k, bias);
+        }
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + lanes <= n; i += lanes) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+            if (biased) {
+                x = _mm256_xor_si256(x, bias);
+            }
+            if constexpr (sizeof(T) == 4) {
+                acc = _mm256_sub_epi32(acc, Inclusive ? _mm256_cmpgt_epi32(x, k) : _mm256_cmpgt_epi32(k, x));
+            }
+            else {
+                acc = _mm256_sub_epi64(acc, Inclusive ? _mm256_cmpgt_epi64(x, k) : _mm256_cmpgt_epi64(k, x));
+            }
+        }
+        alignas(32) int64_t sum[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(sum), (sizeof(T) == 4) ? _mm256_add_epi64(_mm256_and_si256(acc, _mm256_set1_epi64x(UINT32_MAX)), _mm256_srli_epi64(acc, 32)) : acc);
+        size_t hits = static_cast<size_t>(sum[0] + sum[1] + sum[2] + sum[3]);
+        c += Inclusive ? i - hits : hits;
+    }
+#elif defined(__SSE2__)
+    if constexpr (sizeof(T) == 4) {
+        constexpr bool biased = std::is_unsigned_v<T>;
+        const __m128i bias = _mm_set1_epi32(INT32_MIN);
+        __m128i k = _mm_set1_epi32(static_cast<int32_t>(key));
+        if (biased) {
+            k = _mm_xor_si128(k, bias);
+        }
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+            if (biased) {
+                x = _mm_xor_si128(x, bias);
+            }
+            acc = _mm_sub_epi32(acc, Inclusive ? _mm_cmpgt_epi32(x, k) : _mm_cmpgt_epi32(k, x));
+        }
+        alignas(16) int32_t sum[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(sum), acc);
+        size_t hits = static_cast<size_t>(sum[0] + sum[1] + sum[2] + sum[3]);
+        c += Inclusive ? i - hits : hits;
+    }
+#endif
+    for (; i < n; i++) {
+        c += Inclusive ? !(key < keys[i]) : (keys[i] < key);
+    }
+    return c;
+}
+
+// Position of the first key not below key (Inclusive: above key) in sorted [keys, keys + n).
+// Halves the range without branching on the comparison, then counts the final window.
+template<bool Inclusive, typename T>
+size_t rank(const T* keys, size_t n, T key) {
+    size_t lo = 0;
+    size_t len = n;
+    while (len > SEARCH_WINDOW) {
+        size_t half = len / 2;
+        const T& probe = keys[lo + half - 1];
+        lo += (Inclusive ? !(key < probe) : (probe < key)) ? half : 0;
+        len -= half;
+    }
+    return lo + count_below<Inclusive>(keys + lo, len, key);
+}
+
+} // namespace sjtu
+
+#endif // SEARCH_HPP
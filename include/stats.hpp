@@ -0,0 +1,111 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace sjtu {
+
+// Bucket i counts latencies in [2^i, 2^(i+1)) ns; the last bucket takes everything above.
+constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+struct HistogramSnapshot {
+    std::array<uint64_t, HISTOGRAM_BUCKETS> counts_ = {};
+
+    uint64_t count() const;
+
+    // Upper edge of the bucket holding the p-th fraction of samples, in ns.
+    uint64_t percentile(double p) const;
+};
+
+class LatencyHistogram {
+private:
+    std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> counts_ = {};
+
+public:
+    void record(uint64_t ns);
+
+    HistogramSnapshot snapshot() const;
+};
+
+enum class OpKind {
+    Find,
+    FindAll,
+    Insert,
+    Erase,
+    Count
+};
+
+struct BufferStats {
+    size_t capacity_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    size_t evictions_ = 0;
+    size_t prefetched_ = 0;
+    size_t prefetch_hits_ = 0;
+    size_t dirty_pages_ = 0;
+    size_t foreground_writes_ = 0;
+    size_t background_writes_ = 0;
+    size_t checkpoint_writes_ = 0;
+    size_t bytes_read_ = 0;
+    size_t bytes_written_ = 0;
+};
+
+struct TreeStats {
+    BufferStats buffer_;
+    size_t height_ = 0;
+    size_t splits_ = 0;
+    size_t merges_ = 0;
+    size_t borrows_ = 0;
+    size_t pending_messages_ = 0;
+    size_t pinned_pages_ = 0;
+    size_t pinned_bytes_ = 0;
+    size_t bloom_bytes_ = 0;
+    size_t bloom_negatives_ = 0;
+    bool histograms_ = false;
+    std::array<HistogramSnapshot, static_cast<size_t>(OpKind::Count)> latency_;
+};
+
+inline uint64_t HistogramSnapshot::count() const {
+    uint64_t n = 0;
+    for (uint64_t c : counts_) {
+        n += c;
+    }
+    return n;
+}
+
+inline uint64_t HistogramSnapshot::percentile(double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t want = static_cast<uint64_t>(p * static_cast<double>(n));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts_[i];
+        if (seen > want) {
+            return uint64_t(2) << i;
+        }
+    }
+    return uint64_t(2) << (HISTOGRAM_BUCKETS - 1);
+}
+
+inline void LatencyHistogram::record(uint64_t ns) {
+    size_t bucket = (ns == 0) ? 0 : std::min<size_t>(63 - __builtin_clzll(ns), HISTOGRAM_BUCKETS - 1);
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+inline HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snap;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        snap.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    return snap;
+}
+
+} // namespace sjtu
+
+#endif // STATS_HPP
@@ -1,6 +1,7 @@
 #ifndef TYPE_HELPER_HPP
 #define TYPE_HELPER_HPP
 
+#include <cstddef>
 #include <type_traits>
 #include <utility>
 
@@ -25,6 +26,21 @@ GENERATE_OPERATOR_CHECKS
 
 #undef GENERATE_OPERATOR_CHECKS
 
+// Keys exposing their bytes (key_data/key_size/assign_key) are stored in packed leaves;
+// the byte order must agree with the key's operator<.
+template<typename T, typename = void>
+struct has_key_bytes_impl : std::false_type {};
+template<typename T>
+struct has_key_bytes_impl<T, std::void_t<decltype(std::declval<const T&>().key_data()),
+                                         decltype(std::declval<const T&>().key_size()),
+                                         decltype(std::declval<T&>().assign_key(std::declval<const char*>(), std::declval<size_t>()))>> : std::true_type {};
+template<typename T>
+inline constexpr bool has_key_bytes_v = has_key_bytes_impl<T>::value;
+
+// Integral keys are stored in their own contiguous column and searched with vector compares.
+template<typename T>
+inline constexpr bool is_search_integral_v = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
 } // namespace sjtu
 
 #endif // TYPE_HELPER_HPP
\ No newline at end of file
@@ -0,0 +1,185 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.hpp"
+
+namespace sjtu {
+#define LOGMANAGER_TYPE LogManager<FixedType>
+#define LOGMANAGER_TEMPLATE_ARGS template<typename FixedType>
+
+enum class LogType : uint32_t {
+    Insert = 1,
+    Erase = 2,
+    Page = 3,
+    Commit = 4
+};
+
+struct LogRecordHeader {
+    LogType type_;
+    uint32_t len_;
+    uint32_t sum_;
+};
+
+template<typename FixedType>
+class LogManager {
+private:
+    int fd_ = -1;
+    diskpos_t end_ = 0;
+    std::vector<char> buffer_;
+
+    static uint32_t checksum(const LogRecordHeader& header, const char* data);
+
+    void write_out();
+
+public:
+    LogManager() = default;
+
+    LogManager(const LogManager& oth) = delete;
+
+    ~LogManager();
+
+    LogManager& operator=(const LogManager& oth) = delete;
+
+    bool initialise(const std::string& file_name);
+
+    void append(LogType type, const void* data, size_t len);
+
+    void append_page(diskpos_t pos, const FixedType& page);
+
+    void sync();
+
+    void truncate(diskpos_t len);
+
+    diskpos_t size() const;
+
+    template<typename Visitor>
+    diskpos_t scan(Visitor visit);
+};
+
+LOGMANAGER_TEMPLATE_ARGS
+uint32_t LOGMANAGER_TYPE::checksum(const LogRecordHeader& header, const char* data) {
+    uint32_t h = 2166136261u;
+    auto mix = [&h](const char* p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ static_cast<uint8_t>(p[i])) * 16777619u;
+        }
+    };
+    mix(reinterpret_cast<const char *>(&header.type_), sizeof(header.type_));
+    mix(reinterpret_cast<const char *>(&header.len_), sizeof(header.len_));
+    mix(data, header.len_);
+    return h;
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+void LOGMANAGER_TYPE::write_out() {
+    size_t done = 0;
+    while (done < buffer_.size()) {
+        ssize_t r = ::pwrite(fd_, buffer_.data() + done, buffer_.size() - done, end_ + done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        done += r;
+    }
+    end_ += done;
+    buffer_.clear();
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+LOGMANAGER_TYPE::~LogManager() {
+    if (fd_ != -1) {
+        sync();
+        ::close(fd_);
+    }
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+bool LOGMANAGER_TYPE::initialise(const std::string& file_name) {
+    fd_ = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    end_ = (fd_ != -1 && ::fstat(fd_, &st) == 0) ? st.st_size : 0;
+    return end_ > 0;
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+void LOGMANAGER_TYPE::append(LogType type, const void* data, size_t len) {
+    LogRecordHeader header{type, static_cast<uint32_t>(len), 0};
+    header.sum_ = checksum(header, static_cast<const char *>(data));
+    const char* h = reinterpret_cast<const char *>(&header);
+    buffer_.insert(buffer_.end(), h, h + sizeof(header));
+    buffer_.insert(buffer_.end(), static_cast<const char *>(data), static_cast<const char *>(data) + len);
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+void LOGMANAGER_TYPE::append_page(diskpos_t pos, const FixedType& page) {
+    std::vector<char> payload(sizeof(diskpos_t) + sizeof(FixedType));
+    std::memcpy(payload.data(), &pos, sizeof(diskpos_t));
+    std::memcpy(payload.data() + sizeof(diskpos_t), &page, sizeof(FixedType));
+    append(LogType::Page, payload.data(), payload.size());
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+void LOGMANAGER_TYPE::sync() {
+    if (buffer_.empty()) {
+        return;
+    }
+    write_out();
+    ::fdatasync(fd_);
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+void LOGMANAGER_TYPE::truncate(diskpos_t len) {
+    buffer_.clear();
+    if (::ftruncate(fd_, len) == 0) {
+        end_ = len;
+    }
+    ::fsync(fd_);
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+diskpos_t LOGMANAGER_TYPE::size() const {
+    return end_ + buffer_.size();
+}
+
+LOGMANAGER_TEMPLATE_ARGS
+template<typename Visitor>
+diskpos_t LOGMANAGER_TYPE::scan(Visitor visit) {
+    diskpos_t pos = 0;
+    std::vector<char> data;
+    while (pos + static_cast<diskpos_t>(sizeof(LogRecordHeader)) <= end_) {
+        LogRecordHeader header;
+        if (::pread(fd_, &header, sizeof(header), pos) != sizeof(header)) {
+            break;
+        }
+        diskpos_t next = pos + sizeof(header) + header.len_;
+        if (next > end_) {
+            break;
+        }
+        data.resize(header.len_);
+        if (::pread(fd_, data.data(), header.len_, pos + sizeof(header)) != static_cast<ssize_t>(header.len_)) {
+            break;
+        }
+        if (checksum(header, data.data()) != header.sum_) {
+            break;
+        }
+        visit(header.type_, data.data(), header.len_, pos);
+        pos = next;
+    }
+    return pos;
+}
+
+} // namespace sjtu
+
+#endif // WAL_HPP
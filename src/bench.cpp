@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/bpt.hpp"
+#include "fixed_string.hpp"
+
+// Runs standard workloads against string- and integer-keyed trees and prints one JSON object
+// per (key type, dataset size, cache capacity, workload) on stdout. With --pages it instead
+// times single in-memory pages against a plain sorted KeyPair array and prints one JSON object
+// per (operation, key set, layout, fill).
+//
+//   bpt_bench [--sizes 20000,200000] [--caches 64,500] [--file bench.dat] [--bloom] [--message-buffers] [--pin-levels k] [--readahead]
+//   bpt_bench --pages
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* FILE_NAME = "bench.dat";
+
+bool BLOOM = false;
+
+bool MESSAGE_BUFFERS = false;
+
+size_t PIN_LEVELS = 0;
+
+bool READAHEAD = false;
+
+constexpr double ZIPF_THETA = 0.99;
+
+constexpr int DUPLICATES = 64;
+
+constexpr size_t PAGE_OPS = 1 << 21;
+
+constexpr int PAGE_ROUNDS = 5;
+
+// Results of the page timings are folded in here so the compiler keeps the calls.
+volatile size_t SINK = 0;
+
+// Spreads consecutive ids over the key space so random and hot keys do not cluster.
+uint64_t scramble(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+template<typename KeyType>
+KeyType make_key(uint64_t id);
+
+template<>
+FixedString65 make_key<FixedString65>(uint64_t id) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "user%012llu", static_cast<unsigned long long>(id));
+    return FixedString65(buf);
+}
+
+template<>
+int64_t make_key<int64_t>(uint64_t id) {
+    return static_cast<int64_t>(id);
+}
+
+template<typename KeyType>
+const char* key_name();
+
+template<>
+const char* key_name<FixedString65>() {
+    return "FixedString65";
+}
+
+template<>
+const char* key_name<int64_t>() {
+    return "int64";
+}
+
+class Zipf {
+private:
+    std::vector<double> cdf_;
+
+public:
+    Zipf(size_t n, double theta) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+            cdf_[i] = sum;
+        }
+        for (double& c : cdf_) {
+            c /= sum;
+        }
+    }
+
+    template<typename Rng>
+    size_t operator()(Rng& rng) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::min(cdf_.size() - 1, static_cast<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin()));
+    }
+};
+
+struct Result {
+    const char* workload_;
+    size_t ops_ = 0;
+    double seconds_ = 0;
+    std::vector<uint32_t> latency_;
+    size_t page_reads_ = 0;
+    size_t prefetch_hits_ = 0;
+    size_t page_writes_ = 0;
+};
+
+// Times every call of op(i) for i in [0, ops) and records the tree's page I/O over the phase;
+// pages read ahead count as reads.
+template<typename Tree, typename Op>
+Result measure(const char* workload, Tree& tree, size_t ops, Op op) {
+    Result res;
+    res.workload_ = workload;
+    res.ops_ = ops;
+    res.latency_.resize(ops);
+    sjtu::BufferStats before = tree.stats().buffer_;
+    size_t writes = tree.foreground_writes() + tree.background_writes();
+    Clock::time_point begin = Clock::now();
+    Clock::time_point last = begin;
+    for (size_t i = 0; i < ops; i++) {
+        op(i);
+        Clock::time_point now = Clock::now();
+        res.latency_[i] = static_cast<uint32_t>(std::min<int64_t>(UINT32_MAX, std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count()));
+        last = now;
+    }
+    res.seconds_ = std::chrono::duration<double>(last - begin).count();
+    sjtu::BufferStats after = tree.stats().buffer_;
+    res.page_reads_ = after.misses_ + after.prefetched_ - before.misses_ - before.prefetched_;
+    res.prefetch_hits_ = after.prefetch_hits_ - before.prefetch_hits_;
+    res.page_writes_ = tree.foreground_writes() + tree.background_writes() - writes;
+    return res;
+}
+
+uint32_t percentile(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t k = std::min(v.size() - 1, static_cast<size_t>(p * static_cast<double>(v.size())));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+template<typename KeyType>
+void report(Result& res, size_t n, size_t cache) {
+    uint32_t p50 = percentile(res.latency_, 0.50);
+    uint32_t p99 = percentile(res.latency_, 0.99);
+    std::printf("{\"key\":\"%s\",\"workload\":\"%s\",\"n\":%zu,\"cache\":%zu,\"ops\":%zu,\"seconds\":%.6f,"
+                "\"ops_per_sec\":%.0f,\"p50_ns\":%u,\"p99_ns\":%u,\"page_reads\":%zu,\"prefetch_hits\":%zu,\"page_writes\":%zu}\n",
+                key_name<KeyType>(), res.workload_, n, cache, res.ops_, res.seconds_,
+                res.seconds_ > 0 ? static_cast<double>(res.ops_) / res.seconds_ : 0.0, p50, p99, res.page_reads_, res.prefetch_hits_, res.page_writes_);
+    std::fflush(stdout);
+}
+
+void remove_files() {
+    std::remove(FILE_NAME);
+    std::remove((std::string(FILE_NAME) + ".wal").c_str());
+    std::remove((std::string(FILE_NAME) + ".bloom").c_str());
+}
+
+template<typename KeyType>
+void run(size_t n, size_t cache) {
+    typedef sjtu::BPlusTree<KeyType, int> Tree;
+    sjtu::BufferOptions options;
+    options.cache_capacity_ = cache;
+    options.bloom_filter_ = BLOOM;
+    options.message_buffers_ = MESSAGE_BUFFERS;
+    options.pinned_levels_ = PIN_LEVELS;
+    options.readahead_ = READAHEAD;
+    std::mt19937_64 rng(n * 31 + cache);
+
+    remove_files();
+    {
+        Tree tree(FILE_NAME, options);
+        Result res = measure("seq_insert", tree, n, [&](size_t i) {
+            tree.insert(make_key<KeyType>(i), static_cast<int>(i));
+        });
+        report<KeyType>(res, n, cache);
+    }
+
+    // About n distinct ids drawn from [0, 4n), inserted in random order; the tree then
+    // serves the lookup and churn phases.
+    remove_files();
+    std::vector<uint64_t> ids(n);
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = scramble(i) % (n * 4);
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    std::vector<uint64_t> sorted(ids);
+    std::shuffle(ids.begin(), ids.end(), rng);
+    {
+        Tree tree(FILE_NAME, options);
+        Result res = measure("rand_insert", tree, ids.size(), [&](size_t i) {
+            tree.insert(make_key<KeyType>(ids[i]), 0);
+        });
+        report<KeyType>(res, n, cache);
+
+        Zipf zipf(ids.size(), ZIPF_THETA);
+        res = measure("zipf_find", tree, n, [&](size_t) {
+            tree.find(make_key<KeyType>(ids[zipf(rng)]));
+        });
+        report<KeyType>(res, n, cache);
+
+        // Ids in [0, 4n) that were not inserted, so every lookup misses.
+        std::vector<uint64_t> missing;
+        while (missing.size() < n) {
+            uint64_t id = rng() % (n * 4);
+            if (!std::binary_search(sorted.begin(), sorted.end(), id)) {
+                missing.push_back(id);
+            }
+        }
+        res = measure("miss_find", tree, n, [&](size_t i) {
+            tree.find(make_key<KeyType>(missing[i]));
+        });
+        report<KeyType>(res, n, cache);
+
+        // Three erases of live keys per insert of a fresh one.
+        std::vector<uint64_t> live(ids);
+        uint64_t fresh = n * 4;
+        res = measure("delete_churn", tree, n / 2, [&](size_t i) {
+            if (i % 4 == 3 || live.empty()) {
+                live.push_back(fresh);
+                tree.insert(make_key<KeyType>(fresh++), 0);
+            }
+            else {
+                size_t k = rng() % live.size();
+                std::swap(live[k], live.back());
+                tree.erase(make_key<KeyType>(live.back()), 0);
+                live.pop_back();
+            }
+        });
+        report<KeyType>(res, n, cache);
+    }
+
+    // 70% Zipfian finds, 20% inserts, 10% erases over a freshly loaded tree.
+    remove_files();
+    {
+        Tree tree(FILE_NAME, options);
+        size_t idx = 0;
+        tree.bulk_load([&](KeyType& k, int& v) {
+            if (idx == sorted.size()) {
+                return false;
+            }
+            k = make_key<KeyType>(sorted[idx]);
+            v = 0;
+            idx++;
+            return true;
+        });
+        Zipf zipf(ids.size(), ZIPF_THETA);
+        uint64_t fresh = n * 4;
+        Result res = measure("mixed", tree, n, [&](size_t) {
+            uint64_t dice = rng() % 10;
+            if (dice < 7) {
+                tree.find(make_key<KeyType>(ids[zipf(rng)]));
+            }
+            else if (dice < 9) {
+                tree.insert(make_key<KeyType>(fresh++), 0);
+            }
+            else {
+                tree.erase(make_key<KeyType>(ids[rng() % ids.size()]), 0);
+            }
+        });
+        report<KeyType>(res, n, cache);
+    }
+
+    // n entries over n / DUPLICATES keys; find_all returns every value of one key.
+    remove_files();
+    {
+        Tree tree(FILE_NAME, options);
+        size_t keys = std::max<size_t>(1, n / DUPLICATES);
+        for (size_t i = 0; i < n; i++) {
+            tree.insert(make_key<KeyType>(scramble(i % keys)), static_cast<int>(i / keys));
+        }
+        std::vector<int> out;
+        Result res = measure("dup_find_all", tree, keys * 4, [&](size_t) {
+            out.clear();
+            tree.find_all(make_key<KeyType>(scramble(rng() % keys)), out);
+        });
+        report<KeyType>(res, n, cache);
+    }
+    remove_files();
+}
+
+// A 65-byte string key without a byte view, so its leaves use FixedLeafPage.
+struct OpaqueString65 {
+    FixedString65 str_;
+};
+
+bool operator==(const OpaqueString65& a, const OpaqueString65& b) {
+    return a.str_ == b.str_;
+}
+
+bool operator<(const OpaqueString65& a, const OpaqueString65& b) {
+    return a.str_ < b.str_;
+}
+
+void report_page(const char* op, const char* keys, const char* layout, size_t fill, size_t ops, double seconds) {
+    std::printf("{\"page_op\":\"%s\",\"keys\":\"%s\",\"layout\":\"%s\",\"fill\":%zu,\"ops\":%zu,\"ns_per_op\":%.1f}\n",
+                op, keys, layout, fill, ops, seconds * 1e9 / static_cast<double>(ops));
+    std::fflush(stdout);
+}
+
+// Best of PAGE_ROUNDS runs of body(), which performs ops operations; in seconds.
+template<typename Body>
+double best_of(Body body) {
+    double best = 0;
+    for (int round = 0; round < PAGE_ROUNDS; round++) {
+        Clock::time_point begin = Clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        best = (round == 0) ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// Leaf lower_bound(key) on int keys: ColumnLeafPage's branchless rank over the key column
+// against a binary search over KeyPair slots.
+void leaf_search_page(size_t fill) {
+    using Pair = sjtu::KeyPair<int, int>;
+    std::mt19937_64 rng(fill);
+    std::vector<Pair> data;
+    for (size_t i = 0; i < fill; i++) {
+        data.emplace_back(static_cast<int>(rng() % (fill * 16)), static_cast<int>(i));
+    }
+    std::sort(data.begin(), data.end());
+    std::vector<int> probes(PAGE_OPS);
+    for (int& k : probes) {
+        k = static_cast<int>(rng() % (fill * 16));
+    }
+    auto page = std::make_unique<sjtu::Page<int, int>>();
+    auto& leaf = page->init_leaf();
+    leaf.assign(data.data(), data.size());
+    double column = best_of([&] {
+        size_t sum = 0;
+        for (int k : probes) {
+            sum += leaf.lower_bound(k);
+        }
+        SINK = SINK + sum;
+    });
+    double pairs = best_of([&] {
+        size_t sum = 0;
+        for (int k : probes) {
+            sum += sjtu::lower_bound(data.data(), data.size(), k);
+        }
+        SINK = SINK + sum;
+    });
+    report_page("leaf_lower_bound", "int32", "column", fill, PAGE_OPS, column);
+    report_page("leaf_lower_bound", "int32", "pairs", fill, PAGE_OPS, pairs);
+}
+
+// Internal lower_bound(key) over a full page of FixedString65 keys: normalized prefixes
+// against full key compares. Every key of a set starts with prefix.
+void internal_search_page(const char* name, const char* prefix) {
+    using Pair = sjtu::KeyPair<FixedString65, int>;
+    using Internal = sjtu::InternalPage<FixedString65, int>;
+    std::mt19937_64 rng(std::strlen(prefix));
+    auto key = [&](uint64_t id) {
+        char buf[40];
+        std::snprintf(buf, sizeof(buf), "%s%08llu", prefix, static_cast<unsigned long long>(id % 100000000));
+        return FixedString65(buf);
+    };
+    std::vector<Pair> data;
+    for (size_t i = 0; i < Internal::SLOT_COUNT; i++) {
+        data.emplace_back(key(rng()), 0);
+    }
+    std::sort(data.begin(), data.end());
+    std::vector<FixedString65> probes(PAGE_OPS);
+    for (FixedString65& k : probes) {
+        k = key(rng());
+    }
+    auto page = std::make_unique<sjtu::Page<FixedString65, int>>();
+    auto& internal = page->init_internal();
+    for (size_t i = 0; i < data.size(); i++) {
+        internal.insert_at(static_cast<int>(i), data[i], 0);
+    }
+    double normalized = best_of([&] {
+        size_t sum = 0;
+        for (const FixedString65& k : probes) {
+            sum += internal.lower_bound(k);
+        }
+        SINK = SINK + sum;
+    });
+    double pairs = best_of([&] {
+        size_t sum = 0;
+        for (const FixedString65& k : probes) {
+            sum += sjtu::lower_bound(internal.data_, internal.size_, k);
+        }
+        SINK = SINK + sum;
+    });
+    report_page("internal_lower_bound", name, "normalized", data.size(), PAGE_OPS, normalized);
+    report_page("internal_lower_bound", name, "pairs", data.size(), PAGE_OPS, pairs);
+}
+
+// Best insert and erase seconds over PAGE_ROUNDS runs; each run does rounds passes that
+// reset() a page, insert() every entry of inserts and then erase() every entry of erases.
+template<typename Pair, typename Reset, typename Insert, typename Erase>
+std::pair<double, double> fill_and_empty(const std::vector<Pair>& inserts, const std::vector<Pair>& erases, size_t rounds,
+                                         Reset reset, Insert insert, Erase erase) {
+    double best_insert = 0;
+    double best_erase = 0;
+    for (int run = 0; run < PAGE_ROUNDS; run++) {
+        double insert_seconds = 0;
+        double erase_seconds = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            reset();
+            Clock::time_point begin = Clock::now();
+            for (const Pair& kp : inserts) {
+                insert(kp);
+            }
+            Clock::time_point mid = Clock::now();
+            for (const Pair& kp : erases) {
+                erase(kp);
+            }
+            Clock::time_point end = Clock::now();
+            insert_seconds += std::chrono::duration<double>(mid - begin).count();
+            erase_seconds += std::chrono::duration<double>(end - mid).count();
+        }
+        best_insert = (run == 0) ? insert_seconds : std::min(best_insert, insert_seconds);
+        best_erase = (run == 0) ? erase_seconds : std::min(best_erase, erase_seconds);
+    }
+    return {best_insert, best_erase};
+}
+
+// Fills a leaf of 65-byte keys in random order and empties it in another, search included:
+// slotted FixedLeafPage cells against shifting whole KeyPairs.
+void leaf_update_page() {
+    using Pair = sjtu::KeyPair<OpaqueString65, int>;
+    using Leaf = sjtu::FixedLeafPage<OpaqueString65, int>;
+    constexpr size_t fill = Leaf::MAX_WEIGHT;
+    std::mt19937_64 rng(fill);
+    std::vector<Pair> inserts;
+    for (size_t i = 0; i < fill; i++) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "user%08llu", static_cast<unsigned long long>(scramble(i) % 100000000));
+        inserts.emplace_back(OpaqueString65{FixedString65(buf)}, static_cast<int>(i));
+    }
+    std::vector<Pair> erases = inserts;
+    std::shuffle(erases.begin(), erases.end(), rng);
+    size_t rounds = std::max<size_t>(1, PAGE_OPS / 16 / fill);
+    auto page = std::make_unique<sjtu::Page<OpaqueString65, int>>();
+    Leaf* leaf = nullptr;
+    auto slotted = fill_and_empty(inserts, erases, rounds, [&] {
+        leaf = &page->init_leaf();
+    }, [&](const Pair& kp) {
+        int idx = 0;
+        if (leaf->size_ > 0) {
+            int k = leaf->lower_bound(kp);
+            idx = (leaf->at(k) < kp) ? k + 1 : k;
+        }
+        leaf->insert_at(idx, kp);
+    }, [&](const Pair& kp) {
+        leaf->erase_at(leaf->lower_bound(kp));
+    });
+    std::vector<Pair> data(fill);
+    size_t size = 0;
+    auto pairs = fill_and_empty(inserts, erases, rounds, [&] {
+        size = 0;
+    }, [&](const Pair& kp) {
+        int idx = 0;
+        if (size > 0) {
+            int k = sjtu::lower_bound(data.data(), size, kp);
+            idx = (data[k] < kp) ? k + 1 : k;
+        }
+        std::memmove(static_cast<void *>(data.data() + idx + 1), data.data() + idx, (size - idx) * sizeof(Pair));
+        data[idx] = kp;
+        size++;
+    }, [&](const Pair& kp) {
+        int idx = sjtu::lower_bound(data.data(), size, kp);
+        std::memmove(static_cast<void *>(data.data() + idx), data.data() + idx + 1, (size - idx - 1) * sizeof(Pair));
+        size--;
+    });
+    report_page("leaf_insert", "OpaqueString65", "slotted", fill, rounds * fill, slotted.first);
+    report_page("leaf_insert", "OpaqueString65", "pairs", fill, rounds * fill, pairs.first);
+    report_page("leaf_erase", "OpaqueString65", "slotted", fill, rounds * fill, slotted.second);
+    report_page("leaf_erase", "OpaqueString65", "pairs", fill, rounds * fill, pairs.second);
+}
+
+void run_pages() {
+    for (size_t fill : {16, 256, 2000}) {
+        leaf_search_page(fill);
+    }
+    internal_search_page("user%08d", "user");
+    internal_search_page("13-byte prefix", "sharedprefix_");
+    leaf_update_page();
+}
+
+std::vector<size_t> parse_list(const char* arg) {
+    std::vector<size_t> out;
+    char* end = nullptr;
+    for (const char* p = arg; *p; p = (*end == ',') ? end + 1 : end) {
+        out.push_back(std::strtoull(p, &end, 10));
+        if (end == p) {
+            break;
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {20000, 200000};
+    std::vector<size_t> caches = {64, sjtu::CACHE_CAPACITY};
+    bool pages = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pages") == 0) {
+            pages = true;
+        }
+        else if (std::strcmp(argv[i], "--bloom") == 0) {
+            BLOOM = true;
+        }
+        else if (std::strcmp(argv[i], "--message-buffers") == 0) {
+            MESSAGE_BUFFERS = true;
+        }
+        else if (std::strcmp(argv[i], "--readahead") == 0) {
+            READAHEAD = true;
+        }
+        else if (i + 1 < argc && std::strcmp(argv[i], "--pin-levels") == 0) {
+            PIN_LEVELS = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (i + 1 < argc && std::strcmp(argv[i], "--sizes") == 0) {
+            sizes = parse_list(argv[++i]);
+        }
+        else if (i + 1 < argc && std::strcmp(argv[i], "--caches") == 0) {
+            caches = parse_list(argv[++i]);
+        }
+        else if (i + 1 < argc && std::strcmp(argv[i], "--file") == 0) {
+            FILE_NAME = argv[++i];
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--sizes n,...] [--caches c,...] [--file path] [--bloom] [--message-buffers] [--pin-levels k] [--readahead] [--pages]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (pages) {
+        run_pages();
+        return 0;
+    }
+    for (size_t n : sizes) {
+        for (size_t cache : caches) {
+            run<FixedString65>(n, cache);
+            run<int64_t>(n, cache);
+        }
+    }
+    return 0;
+}
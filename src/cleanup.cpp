@@ -13,13 +13,13 @@ void clearFiles(const std::string& directory = ".") {
         for (const auto& entry : fs::directory_iterator(directory)) {
             if (entry.is_regular_file()) {
                 const auto& path = entry.path();
-                if (path.extension() == ".dat") {
+                if (path.extension() == ".dat" || path.extension() == ".wal" || path.extension() == ".bloom") {
                     fs::remove(path);
                     count++;
                 }
             }
         }
-        std::cout << "共删除了 " << count << " 个 .dat 文件" << std::endl;
+        std::cout << "共删除了 " << count << " 个 .dat / .wal / .bloom 文件" << std::endl;
     } catch (const fs::filesystem_error& ex) {
         std::cerr << "文件系统错误: " << ex.what() << std::endl;
     } catch (const std::exception& ex) {
@@ -28,7 +28,7 @@ void clearFiles(const std::string& directory = ".") {
 }
 
 int main() {
-    std::cout << "开始清理当前目录下的 .dat 文件..." << std::endl;
+    std::cout << "开始清理当前目录下的 .dat / .wal / .bloom 文件..." << std::endl;
     clearFiles(".");
     std::cout << "清理完成" << std::endl;
     return 0;
@@ -0,0 +1,209 @@
+#ifndef FAST_IO_HPP
+#define FAST_IO_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Whitespace-separated tokens from stdin without per-token allocation. A regular file is
+// mapped whole; pipes and terminals go through one large buffer that is refilled in place.
+class Input {
+private:
+	static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+	std::unique_ptr<char[]> buffer_;
+	char* map_ = nullptr;
+	size_t map_size_ = 0;
+	const char* cur_ = nullptr;
+	const char* end_ = nullptr;
+	bool eof_ = false;
+
+	static bool is_space(char c) { return static_cast<unsigned char>(c) <= ' '; }
+
+	// Moves [keep, end_) to the front of the buffer and reads more after it; keep is
+	// updated. False when no new input arrived.
+	bool refill(const char*& keep) {
+		if (map_ != nullptr || eof_) {
+			return false;
+		}
+		size_t left = end_ - keep;
+		if (left == BUFFER_SIZE) {
+			return false;
+		}
+		std::memmove(buffer_.get(), keep, left);
+		keep = buffer_.get();
+		ssize_t r;
+		do {
+			r = ::read(STDIN_FILENO, buffer_.get() + left, BUFFER_SIZE - left);
+		} while (r < 0 && errno == EINTR);
+		end_ = buffer_.get() + left + (r > 0 ? r : 0);
+		if (r <= 0) {
+			eof_ = true;
+			return false;
+		}
+		return true;
+	}
+
+public:
+	Input() {
+		struct stat st;
+		off_t offset = ::lseek(STDIN_FILENO, 0, SEEK_CUR);
+		if (::fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset) {
+			void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+			if (p != MAP_FAILED) {
+				::madvise(p, st.st_size, MADV_SEQUENTIAL);
+				map_ = static_cast<char *>(p);
+				map_size_ = st.st_size;
+				cur_ = map_ + offset;
+				end_ = map_ + map_size_;
+				return;
+			}
+		}
+		buffer_.reset(new char[BUFFER_SIZE]);
+		cur_ = end_ = buffer_.get();
+	}
+
+	Input(const Input&) = delete;
+
+	Input& operator=(const Input&) = delete;
+
+	~Input() {
+		if (map_ != nullptr) {
+			::munmap(map_, map_size_);
+		}
+	}
+
+	// The next token as [s, s + n); valid until the following call.
+	bool token(const char*& s, size_t& n) {
+		while (true) {
+			while (cur_ < end_ && is_space(*cur_)) {
+				cur_++;
+			}
+			if (cur_ < end_) {
+				break;
+			}
+			if (!refill(cur_)) {
+				return false;
+			}
+		}
+		const char* start = cur_;
+		while (true) {
+			while (cur_ < end_ && !is_space(*cur_)) {
+				cur_++;
+			}
+			size_t len = cur_ - start;
+			if (cur_ < end_ || !refill(start)) {
+				cur_ = start + len;
+				break;
+			}
+			cur_ = start + len;
+		}
+		s = start;
+		n = cur_ - start;
+		return true;
+	}
+
+	bool read_int(int& x) {
+		const char* s;
+		size_t n;
+		if (!token(s, n)) {
+			return false;
+		}
+		size_t i = 0;
+		bool neg = (n > 0 && s[0] == '-');
+		if (neg || (n > 0 && s[0] == '+')) {
+			i++;
+		}
+		long long v = 0;
+		for (; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+			v = v * 10 + (s[i] - '0');
+		}
+		x = static_cast<int>(neg ? -v : v);
+		return true;
+	}
+};
+
+// Collects output in one large buffer and hands it to write(2) when full and on destruction.
+class Output {
+private:
+	static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+	std::unique_ptr<char[]> buffer_;
+	size_t len_ = 0;
+
+	static void write_all(const char* s, size_t n) {
+		size_t done = 0;
+		while (done < n) {
+			ssize_t r = ::write(STDOUT_FILENO, s + done, n - done);
+			if (r < 0 && errno == EINTR) {
+				continue;
+			}
+			if (r <= 0) {
+				break;
+			}
+			done += r;
+		}
+	}
+
+public:
+	Output() : buffer_(new char[BUFFER_SIZE]) {}
+
+	Output(const Output&) = delete;
+
+	Output& operator=(const Output&) = delete;
+
+	~Output() { flush(); }
+
+	void flush() {
+		write_all(buffer_.get(), len_);
+		len_ = 0;
+	}
+
+	void put(char c) {
+		if (len_ == BUFFER_SIZE) {
+			flush();
+		}
+		buffer_[len_++] = c;
+	}
+
+	void put(const char* s, size_t n) {
+		if (len_ + n > BUFFER_SIZE) {
+			flush();
+		}
+		if (n > BUFFER_SIZE) {
+			write_all(s, n);
+			return;
+		}
+		std::memcpy(buffer_.get() + len_, s, n);
+		len_ += n;
+	}
+
+	void put(const char* s) { put(s, std::strlen(s)); }
+
+	void put_int(long long x) {
+		char digits[24];
+		size_t n = 0;
+		unsigned long long v = (x < 0) ? 0ull - static_cast<unsigned long long>(x) : static_cast<unsigned long long>(x);
+		do {
+			digits[n++] = static_cast<char>('0' + v % 10);
+			v /= 10;
+		} while (v != 0);
+		if (x < 0) {
+			digits[n++] = '-';
+		}
+		if (len_ + n > BUFFER_SIZE) {
+			flush();
+		}
+		while (n > 0) {
+			buffer_[len_++] = digits[--n];
+		}
+	}
+};
+
+#endif // FAST_IO_HPP
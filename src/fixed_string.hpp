@@ -0,0 +1,56 @@
+#ifndef FIXED_STRING_HPP
+#define FIXED_STRING_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Fixed-length string key to ensure POD storage on disk
+struct FixedString65 {
+	char data_[65];
+
+	FixedString65() { std::memset(data_, 0, sizeof(data_)); }
+
+	explicit FixedString65(const char* s) {
+		std::memset(data_, 0, sizeof(data_));
+		std::strncpy(data_, s, sizeof(data_) - 1);
+	}
+
+	explicit FixedString65(const std::string& s) : FixedString65(s.c_str()) {}
+
+	// Key bytes for packed leaves; strcmp order is the byte order of these spans
+	size_t key_size() const { return std::strlen(data_); }
+
+	const char* key_data() const { return data_; }
+
+	void assign_key(const char* s, size_t n) {
+		std::memset(data_, 0, sizeof(data_));
+		std::memcpy(data_, s, n);
+	}
+};
+
+inline bool operator==(const FixedString65& a, const FixedString65& b) {
+	return std::strcmp(a.data_, b.data_) == 0;
+}
+
+inline bool operator!=(const FixedString65& a, const FixedString65& b) {
+	return !(a == b);
+}
+
+inline bool operator<(const FixedString65& a, const FixedString65& b) {
+	return std::strcmp(a.data_, b.data_) < 0;
+}
+
+inline bool operator>(const FixedString65& a, const FixedString65& b) {
+	return std::strcmp(a.data_, b.data_) > 0;
+}
+
+inline bool operator<=(const FixedString65& a, const FixedString65& b) {
+	return std::strcmp(a.data_, b.data_) <= 0;
+}
+
+inline bool operator>=(const FixedString65& a, const FixedString65& b) {
+	return std::strcmp(a.data_, b.data_) >= 0;
+}
+
+#endif // FIXED_STRING_HPP
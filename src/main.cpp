@@ -1,84 +1,168 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <iostream>
 #include <string>
 #include <vector>
 
 #include "../include/bpt.hpp"
+#include "fast_io.hpp"
+#include "fixed_string.hpp"
 
-// Fixed-length string key to ensure POD storage on disk
-struct FixedString65 {
-	char data_[65];
-
-	FixedString65() { std::memset(data_, 0, sizeof(data_)); }
-
-	explicit FixedString65(const char* s) {
-		std::memset(data_, 0, sizeof(data_));
-		std::strncpy(data_, s, sizeof(data_) - 1);
-	}
-
-	explicit FixedString65(const std::string& s) : FixedString65(s.c_str()) {}
-};
-
-inline bool operator==(const FixedString65& a, const FixedString65& b) {
-	return std::strcmp(a.data_, b.data_) == 0;
-}
-
-inline bool operator!=(const FixedString65& a, const FixedString65& b) {
-	return !(a == b);
+void put_counter(Output& out, const char* name, size_t value) {
+	out.put(name);
+	out.put(' ');
+	out.put_int(static_cast<long long>(value));
+	out.put('\n');
 }
 
-inline bool operator<(const FixedString65& a, const FixedString65& b) {
-	return std::strcmp(a.data_, b.data_) < 0;
+// One "name value" line per counter
+void print_stats(Output& out, const sjtu::TreeStats& stats) {
+	const sjtu::BufferStats& buf = stats.buffer_;
+	put_counter(out, "buffer.capacity", buf.capacity_);
+	put_counter(out, "buffer.hits", buf.hits_);
+	put_counter(out, "buffer.misses", buf.misses_);
+	put_counter(out, "buffer.evictions", buf.evictions_);
+	put_counter(out, "buffer.prefetched", buf.prefetched_);
+	put_counter(out, "buffer.prefetch_hits", buf.prefetch_hits_);
+	put_counter(out, "buffer.dirty_pages", buf.dirty_pages_);
+	put_counter(out, "buffer.foreground_writes", buf.foreground_writes_);
+	put_counter(out, "buffer.background_writes", buf.background_writes_);
+	put_counter(out, "buffer.checkpoint_writes", buf.checkpoint_writes_);
+	put_counter(out, "buffer.bytes_read", buf.bytes_read_);
+	put_counter(out, "buffer.bytes_written", buf.bytes_written_);
+	put_counter(out, "tree.height", stats.height_);
+	put_counter(out, "tree.splits", stats.splits_);
+	put_counter(out, "tree.merges", stats.merges_);
+	put_counter(out, "tree.borrows", stats.borrows_);
+	put_counter(out, "tree.pending_messages", stats.pending_messages_);
+	put_counter(out, "tree.pinned_pages", stats.pinned_pages_);
+	put_counter(out, "tree.pinned_bytes", stats.pinned_bytes_);
+	put_counter(out, "bloom.bytes", stats.bloom_bytes_);
+	put_counter(out, "bloom.negatives", stats.bloom_negatives_);
+	if (!stats.histograms_) {
+		return;
+	}
+	const char* names[] = {"find", "find_all", "insert", "erase"};
+	for (size_t i = 0; i < stats.latency_.size(); i++) {
+		const sjtu::HistogramSnapshot& h = stats.latency_[i];
+		std::string prefix = std::string("latency.") + names[i];
+		put_counter(out, (prefix + ".count").c_str(), h.count());
+		put_counter(out, (prefix + ".p50_ns").c_str(), h.percentile(0.50));
+		put_counter(out, (prefix + ".p99_ns").c_str(), h.percentile(0.99));
+	}
 }
 
-inline bool operator>(const FixedString65& a, const FixedString65& b) {
-	return std::strcmp(a.data_, b.data_) > 0;
+// Key from a token; longer tokens are cut to the key capacity like the string constructor
+FixedString65 make_key(const char* s, size_t n) {
+	FixedString65 key;
+	key.assign_key(s, std::min(n, sizeof(key.data_) - 1));
+	return key;
 }
 
-inline bool operator<=(const FixedString65& a, const FixedString65& b) {
-	return std::strcmp(a.data_, b.data_) <= 0;
+bool token_is(const char* s, size_t n, const char* word) {
+	return n == std::strlen(word) && std::memcmp(s, word, n) == 0;
 }
 
-inline bool operator>=(const FixedString65& a, const FixedString65& b) {
-	return std::strcmp(a.data_, b.data_) >= 0;
+// The value after an option that takes an optional one; anything starting with '-' is the next option.
+const char* option_value(int argc, char* argv[], int& i) {
+	if (i + 1 < argc && argv[i + 1][0] != '-') {
+		return argv[++i];
+	}
+	return nullptr;
 }
 
-int main() {
-	std::ios::sync_with_stdio(false);
-	std::cin.tie(nullptr);
-
-	sjtu::BPlusTree<FixedString65, int> bpt;
+int main(int argc, char* argv[]) {
+	sjtu::BufferOptions options;
+	bool bulk_load = false;
+	double fill_factor = sjtu::BULK_LOAD_FILL_FACTOR;
+	for (int i = 1; i < argc; i++) {
+		// Per-operation latency histograms for the stats command
+		if (std::strcmp(argv[i], "--histograms") == 0) {
+			options.latency_histograms_ = true;
+		}
+		// Bloom filter over the keys, kept in bpt.dat.bloom between runs; absent keys skip the tree
+		else if (std::strcmp(argv[i], "--bloom") == 0) {
+			options.bloom_filter_ = true;
+		}
+		// Internal pages buffer pending writes and pass them down in batches
+		else if (std::strcmp(argv[i], "--message-buffers") == 0) {
+			options.message_buffers_ = true;
+		}
+		// Top levels of the tree stay pinned in memory; lookups touch the pool only at the leaf
+		else if (std::strcmp(argv[i], "--pin-levels") == 0) {
+			const char* value = option_value(argc, argv, i);
+			options.pinned_levels_ = (value != nullptr) ? std::strtoul(value, nullptr, 10) : sjtu::PINNED_LEVELS;
+		}
+		// Leaves further along a long run are read in batches ahead of find
+		else if (std::strcmp(argv[i], "--readahead") == 0) {
+			options.readahead_ = true;
+		}
+		// Sorted "key value" pairs until EOF, packed bottom-up into an empty tree
+		else if (std::strcmp(argv[i], "--bulk-load") == 0) {
+			bulk_load = true;
+			const char* value = option_value(argc, argv, i);
+			if (value != nullptr) {
+				fill_factor = std::atof(value);
+			}
+		}
+		else {
+			std::fprintf(stderr, "usage: %s [--histograms] [--bloom] [--message-buffers] [--pin-levels [k]] [--readahead] [--bulk-load [fill_factor]]\n", argv[0]);
+			return 1;
+		}
+	}
+	sjtu::BPlusTree<FixedString65, int> bpt("bpt.dat", options);
+	Input in;
+	Output out;
+	const char* s = nullptr;
+	size_t n = 0;
+	if (bulk_load) {
+		bpt.bulk_load([&](FixedString65& k, int& v) {
+			if (!in.token(s, n)) {
+				return false;
+			}
+			k = make_key(s, n);
+			return in.read_int(v);
+		}, fill_factor);
+		return 0;
+	}
 	int q = 0;
-	if (!(std::cin >> q)) {
+	if (!in.read_int(q)) {
 		return 0;
 	}
-	while (q--) {
-		std::string op;
-		std::string key;
+	// Reused by every find; find_all clears it
+	std::vector<int> vec;
+	while (q-- > 0 && in.token(s, n)) {
 		int val = 0;
-		std::cin >> op;
-		if (op == "insert") {
-			std::cin >> key >> val;
-			bpt.insert(FixedString65(key), val);
+		if (token_is(s, n, "insert")) {
+			in.token(s, n);
+			FixedString65 key = make_key(s, n);
+			in.read_int(val);
+			bpt.insert(key, val);
 		}
-		else if (op == "find") {
-			std::cin >> key;
-			std::vector<int> vec;
-			bpt.find_all(FixedString65(key), vec);
+		else if (token_is(s, n, "find")) {
+			in.token(s, n);
+			bpt.find_all(make_key(s, n), vec);
 			if (vec.empty()) {
-				std::cout << "null\n";
+				out.put("null\n", 5);
 			}
 			else {
 				for (int v : vec) {
-					std::cout << v << ' ';
+					out.put_int(v);
+					out.put(' ');
 				}
-				std::cout << '\n';
+				out.put('\n');
 			}
 		}
-		else if (op == "delete") {
-			std::cin >> key >> val;
-			bpt.erase(FixedString65(key), val);
+		else if (token_is(s, n, "delete")) {
+			in.token(s, n);
+			FixedString65 key = make_key(s, n);
+			in.read_int(val);
+			bpt.erase(key, val);
+		}
+		else if (token_is(s, n, "stats")) {
+			print_stats(out, bpt.stats());
 		}
 	}
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "../include/bpt.hpp"
+#include "../src/fixed_string.hpp"
+
+// Checks the tree against std::multiset for each leaf layout: reopening a file, WAL replay after
+// a torn tail, find_all on keys whose values span several leaves, and writers running next to
+// scanning readers. Exits non-zero on the first mismatch.
+
+namespace {
+
+#define CHECK(cond)                                                                       \
+    do {                                                                                  \
+        if (!(cond)) {                                                                    \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                                 \
+        }                                                                                 \
+    } while (0)
+
+const char* FILE_NAME = "bpt_test.dat";
+
+// A 65-byte string key without a byte view, so its leaves use FixedLeafPage.
+struct OpaqueString65 {
+    FixedString65 str_;
+};
+
+bool operator==(const OpaqueString65& a, const OpaqueString65& b) {
+    return a.str_ == b.str_;
+}
+
+bool operator<(const OpaqueString65& a, const OpaqueString65& b) {
+    return a.str_ < b.str_;
+}
+
+template<typename KeyType>
+KeyType make_key(uint64_t id);
+
+template<>
+FixedString65 make_key<FixedString65>(uint64_t id) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key%06llu", static_cast<unsigned long long>(id));
+    return FixedString65(buf);
+}
+
+template<>
+OpaqueString65 make_key<OpaqueString65>(uint64_t id) {
+    return OpaqueString65{make_key<FixedString65>(id)};
+}
+
+template<>
+int64_t make_key<int64_t>(uint64_t id) {
+    return static_cast<int64_t>(id);
+}
+
+void remove_files() {
+    std::remove(FILE_NAME);
+    std::remove((std::string(FILE_NAME) + ".wal").c_str());
+    std::remove((std::string(FILE_NAME) + ".bloom").c_str());
+}
+
+struct Op {
+    bool erase_;
+    uint64_t id_;
+    int val_;
+};
+
+using Reference = std::multiset<std::pair<uint64_t, int>>;
+
+// Random inserts and erases over [0, keys) with a few values per key; inserts never repeat a
+// pair that is present, so the tree and a multiset agree.
+std::vector<Op> random_ops(Reference& ref, size_t n, uint64_t keys, std::mt19937_64& rng) {
+    std::vector<Op> ops;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t id = rng() % keys;
+        int val = static_cast<int>(rng() % 4);
+        if (rng() % 3 == 0) {
+            ops.push_back({true, id, val});
+            ref.erase({id, val});
+        }
+        else if (ref.count({id, val}) == 0) {
+            ops.push_back({false, id, val});
+            ref.insert({id, val});
+        }
+    }
+    return ops;
+}
+
+template<typename KeyType>
+void replay(sjtu::BPlusTree<KeyType, int>& tree, const std::vector<Op>& ops) {
+    for (const Op& op : ops) {
+        if (op.erase_) {
+            tree.erase(make_key<KeyType>(op.id_), op.val_);
+        }
+        else {
+            tree.insert(make_key<KeyType>(op.id_), op.val_);
+        }
+    }
+}
+
+// Every key in [0, keys) answers find_all like ref, and a full scan visits ref in order.
+template<typename KeyType>
+void verify(sjtu::BPlusTree<KeyType, int>& tree, const Reference& ref, uint64_t keys) {
+    std::vector<int> found;
+    for (uint64_t id = 0; id < keys; id++) {
+        tree.find_all(make_key<KeyType>(id), found);
+        std::vector<int> expected;
+        for (auto it = ref.lower_bound({id, INT32_MIN}); it != ref.end() && it->first == id; ++it) {
+            expected.push_back(it->second);
+        }
+        CHECK(found == expected);
+    }
+    auto it = ref.begin();
+    for (auto cursor = tree.begin(); cursor.valid(); cursor.next()) {
+        CHECK(it != ref.end());
+        CHECK(cursor.key() == make_key<KeyType>(it->first));
+        CHECK(cursor.value() == it->second);
+        ++it;
+    }
+    CHECK(it == ref.end());
+}
+
+// What one tree writes, the next tree opened on the file reads back.
+template<typename KeyType>
+void test_reopen(const sjtu::BufferOptions& options) {
+    remove_files();
+    std::mt19937_64 rng(1);
+    Reference ref;
+    constexpr uint64_t keys = 3000;
+    for (int round = 0; round < 3; round++) {
+        sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+        verify(tree, ref, keys);
+        replay(tree, random_ops(ref, 8000, keys, rng));
+    }
+    sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+    verify(tree, ref, keys);
+}
+
+// A child process logs operations, syncs the log and exits without closing the tree. The log
+// then gets a record whose length does not fit its type, a valid insert, and a header whose
+// payload runs past the end of the file. Opening the tree replays what the child synced and
+// drops everything from the bad record on.
+template<typename KeyType>
+void test_wal_torn_tail() {
+    remove_files();
+    sjtu::BufferOptions options;
+    options.wal_ = true;
+    options.cache_capacity_ = 64;
+    std::mt19937_64 rng(2);
+    Reference ref;
+    constexpr uint64_t keys = 3000;
+    std::vector<Op> ops = random_ops(ref, 20000, keys, rng);
+    std::fflush(stdout);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+        replay(tree, ops);
+        tree.sync();
+        ::_exit(0);
+    }
+    int status = 0;
+    CHECK(::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        sjtu::LogManager<char> wal;
+        wal.initialise(std::string(FILE_NAME) + ".wal");
+        sjtu::KeyPair<KeyType, int> kp(make_key<KeyType>(keys), 0);
+        wal.append(sjtu::LogType::Insert, &kp, sizeof(kp) - 1);
+        wal.append(sjtu::LogType::Insert, &kp, sizeof(kp));
+        wal.sync();
+    }
+    {
+        std::FILE* file = std::fopen((std::string(FILE_NAME) + ".wal").c_str(), "ab");
+        CHECK(file != nullptr);
+        sjtu::LogRecordHeader header{sjtu::LogType::Insert, 1 << 20, 0};
+        std::fwrite(&header, sizeof(header), 1, file);
+        std::fputs("torn", file);
+        std::fclose(file);
+    }
+    {
+        sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+        verify(tree, ref, keys + 1);
+        replay(tree, random_ops(ref, 4000, keys, rng));
+    }
+    sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+    verify(tree, ref, keys + 1);
+}
+
+// Runs of one key long enough to cover several leaves, between neighbours with few values.
+// The values arrive in random order and half of them are erased again.
+template<typename KeyType>
+void test_duplicates(const sjtu::BufferOptions& options) {
+    remove_files();
+    std::mt19937_64 rng(3);
+    Reference ref;
+    constexpr uint64_t keys = 9;
+    std::vector<std::pair<uint64_t, int>> pairs;
+    for (uint64_t id = 0; id < keys; id++) {
+        int values = (id % 3 == 1) ? 8000 : 3;
+        for (int v = 0; v < values; v++) {
+            pairs.push_back({id, v});
+        }
+    }
+    std::shuffle(pairs.begin(), pairs.end(), rng);
+    sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+    for (const auto& p : pairs) {
+        tree.insert(make_key<KeyType>(p.first), p.second);
+        ref.insert(p);
+    }
+    verify(tree, ref, keys);
+    std::shuffle(pairs.begin(), pairs.end(), rng);
+    for (size_t i = 0; i < pairs.size() / 2; i++) {
+        tree.erase(make_key<KeyType>(pairs[i].first), pairs[i].second);
+        ref.erase(pairs[i]);
+    }
+    verify(tree, ref, keys);
+}
+
+// Writers insert and erase disjoint ranges of keys while readers keep scanning the whole tree
+// and looking up the keys loaded beforehand, which carry the value -1 and are never erased.
+// Every scan comes back sorted with all of those keys; the writers still have to get through,
+// and afterwards the tree holds exactly what they left.
+template<typename KeyType>
+void test_concurrent(bool wal) {
+    remove_files();
+    sjtu::BufferOptions options;
+    options.concurrent_ = true;
+    options.wal_ = wal;
+    options.cache_capacity_ = 256;
+    constexpr uint64_t loaded = 4000;
+    constexpr uint64_t writers = 3;
+    constexpr uint64_t per_writer = 2000;
+    constexpr uint64_t keys = loaded + writers * per_writer;
+    Reference ref;
+    sjtu::BPlusTree<KeyType, int> tree(FILE_NAME, options);
+    for (uint64_t id = 0; id < loaded; id++) {
+        tree.insert(make_key<KeyType>(id), -1);
+        ref.insert({id, -1});
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&, r] {
+            std::mt19937_64 rng(10 + r);
+            std::vector<int> found;
+            while (!stop && !failed) {
+                bool first = true;
+                sjtu::KeyPair<KeyType, int> prev;
+                uint64_t seen = 0;
+                tree.scan(make_key<KeyType>(0), make_key<KeyType>(keys), [&](const KeyType& key, const int& val) {
+                    sjtu::KeyPair<KeyType, int> cur(key, val);
+                    if (!first && !(prev < cur)) {
+                        failed = true;
+                    }
+                    first = false;
+                    prev = cur;
+                    seen += (val == -1);
+                });
+                tree.find_all(make_key<KeyType>(rng() % loaded), found);
+                if (seen != loaded || found != std::vector<int>{-1}) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> threads;
+    for (uint64_t w = 0; w < writers; w++) {
+        threads.emplace_back([&, w] {
+            uint64_t begin = loaded + w * per_writer;
+            for (uint64_t id = begin; id < begin + per_writer; id++) {
+                tree.insert(make_key<KeyType>(id), static_cast<int>(id % 5));
+            }
+            for (uint64_t id = begin; id < begin + per_writer; id += 2) {
+                tree.erase(make_key<KeyType>(id), static_cast<int>(id % 5));
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    stop = true;
+    for (std::thread& t : readers) {
+        t.join();
+    }
+    CHECK(!failed);
+    for (uint64_t id = loaded + 1; id < keys; id += 2) {
+        ref.insert({id, static_cast<int>(id % 5)});
+    }
+    verify(tree, ref, keys);
+}
+
+template<typename KeyType>
+void run(const char* name) {
+    std::vector<sjtu::BufferOptions> configs(4);
+    configs[1].message_buffers_ = true;
+    configs[2].bloom_filter_ = true;
+    configs[3].pinned_levels_ = 2;
+    configs[3].readahead_ = true;
+    for (sjtu::BufferOptions& options : configs) {
+        options.cache_capacity_ = 64;
+        test_reopen<KeyType>(options);
+        test_duplicates<KeyType>(options);
+    }
+    test_wal_torn_tail<KeyType>();
+    test_concurrent<KeyType>(false);
+    test_concurrent<KeyType>(true);
+    remove_files();
+    std::printf("%s ok\n", name);
+}
+
+} // namespace
+
+int main() {
+    run<FixedString65>("FixedString65");
+    run<int64_t>("int64");
+    run<OpaqueString65>("OpaqueString65");
+    return 0;
+}